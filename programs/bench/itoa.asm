@@ -0,0 +1,67 @@
+# instructions taken by itoa, against a digit at a time:
+# masm -c -o itoa.o itoa.asm ; mlink -o itoa.bin itoa.o report.o runtime.o ; vm -l itoa.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const N d65535
+
+.global itoa start stop
+
+.boot
+lim r0 d1600
+
+@leaf(.start)
+lim r2 N
+lim r3 d1700
+@leaf(.byteItoa)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 N
+lim r3 d1700
+@leaf(.itoa)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.byteItoa
+add r11 r3 r15
+lim r10 .powers
+lim r9 d0
+.byteItoaDigit
+l16 r12 r10 d0
+beq r12 r15 d60
+nor r13 r12 r12
+lim r4 d0
+.byteItoaSub
+blt r2 r12 d12
+adc r2 r2 r13
+adc r4 r4 r15
+beq r15 r15 d-16
+.byteItoaPut
+eth r9 r9 r4
+beq r9 r15 d16
+lim r5 d48
+add r4 r4 r5
+s08 r8 r3 d0
+adc r3 r3 r15
+.byteItoaNext
+lim r5 d2
+add r10 r10 r5
+beq r15 r15 d-68
+.byteItoaLast
+lim r5 d48
+add r4 r2 r5
+s08 r8 r3 d0
+s08 r30 r3 d1
+add r2 r11 r15
+jal r1 r1 d0
+
+.powers
+.half d10000 d1000 d100 d10 d0
+.byteName
+"itoa, a digit at a time: \0"
+.wordName
+"itoa, two digits at a time: \0"
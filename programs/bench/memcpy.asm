@@ -0,0 +1,53 @@
+# instructions taken by memcpy, against a byte at a time:
+# masm -c -o memcpy.o memcpy.asm ; mlink -o memcpy.bin memcpy.o report.o runtime.o ; vm -l memcpy.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const SRC d4096
+#!const DST d8192
+#!const N d200
+
+.global memcpy memset start stop
+
+.boot
+lim r0 d1600
+lim r2 SRC
+lim r3 'a
+lim r4 N
+@leaf(.memset)
+
+@leaf(.start)
+lim r2 DST
+lim r3 SRC
+lim r4 N
+@leaf(.byteCopy)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 DST
+lim r3 SRC
+lim r4 N
+@leaf(.memcpy)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.byteCopy
+lim r14 d-1
+.byteCopyLoop
+beq r4 r15 d24
+l08 r16 r3 d0
+s08 r16 r2 d0
+adc r2 r2 r15
+adc r3 r3 r15
+add r4 r4 r14
+beq r15 r15 d-28
+.byteCopyEnd
+jal r1 r1 d0
+
+.byteName
+"memcpy, a byte at a time: \0"
+.wordName
+"memcpy, a word at a time: \0"
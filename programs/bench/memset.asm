@@ -0,0 +1,46 @@
+# instructions taken by memset, against a byte at a time:
+# masm -c -o memset.o memset.asm ; mlink -o memset.bin memset.o report.o runtime.o ; vm -l memset.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const DST d8192
+#!const N d200
+
+.global memset start stop
+
+.boot
+lim r0 d1600
+
+@leaf(.start)
+lim r2 DST
+lim r3 'a
+lim r4 N
+@leaf(.byteSet)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 DST
+lim r3 'a
+lim r4 N
+@leaf(.memset)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.byteSet
+lim r14 d-1
+.byteSetLoop
+beq r4 r15 d16
+s08 r6 r2 d0
+adc r2 r2 r15
+add r4 r4 r14
+beq r15 r15 d-20
+.byteSetEnd
+jal r1 r1 d0
+
+.byteName
+"memset, a byte at a time: \0"
+.wordName
+"memset, a word at a time: \0"
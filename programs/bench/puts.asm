@@ -0,0 +1,43 @@
+# instructions taken by puts, against a byte at a time:
+# masm -c -o puts.o puts.asm ; mlink -o puts.bin puts.o report.o runtime.o ; vm -l puts.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+.global puts start stop
+
+.boot
+lim r0 d1600
+
+@leaf(.start)
+lim r2 .line
+@leaf(.bytePuts)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 .line
+@leaf(.puts)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.bytePuts
+lim r3 d1022
+lim r4 d0
+.bytePutsLoop
+l08 r8 r2 d0
+beq r4 r15 d16
+s08 r8 r3 d1
+s08 r8 r3 d0
+adc r2 r2 r15
+beq r15 r15 d-24
+.bytePutsEnd
+jal r1 r1 d0
+
+.line
+"the quick brown fox jumps over the lazy dog\n\0"
+.byteName
+"puts, a byte at a time: \0"
+.wordName
+"puts, a half at a time: \0"
@@ -0,0 +1,49 @@
+# report(r2 name, r3 count): writes "name count" and a newline, for the benchmarks
+#
+# start() and stop(r2 name) count the instructions run between the calls to them from the low half of PERF_INS, see vm/vm.h,
+# and report that count under name; start keeps its count at the caller's stack top, so the caller mustn't move r0 in between.
+# the instructions taken by the calls themselves are left out, so the count is only that of the code between them.
+
+#!func      s16 r1 r0 d0
+#!return    l16 r1 r0 d0 ; lim r2 d-2 ; add r0 r0 r2 ; jal r1 r1 d0
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const PERF_INS d1188
+#!const CALLS d4
+
+.global report start stop puts itoa
+
+.start
+lim r13 PERF_INS
+l16 r13 r13 d0
+s16 r13 r0 d0
+jal r1 r1 d0
+
+# stop returns through report, with the stack moved past start's count
+.stop
+lim r13 PERF_INS
+l16 r13 r13 d0
+l16 r12 r0 d0
+nor r12 r12 r12
+adc r3 r13 r12
+lim r12 CALLS
+nor r12 r12 r12
+adc r3 r3 r12
+adc r0 r0 r15
+adc r0 r0 r15
+
+.report
+@func
+s16 r3 r0 d2
+@leaf(.puts)
+lim r3 d4
+add r3 r0 r3
+l16 r2 r0 d2
+@leaf(.itoa)
+@leaf(.puts)
+lim r2 .newline
+@leaf(.puts)
+@return
+
+.newline
+"\n\0"
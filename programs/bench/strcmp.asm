@@ -0,0 +1,70 @@
+# instructions taken by strcmp, against a byte at a time:
+# masm -c -o strcmp.o strcmp.asm ; mlink -o strcmp.bin strcmp.o report.o runtime.o ; vm -l strcmp.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const A d4096
+#!const B d8192
+#!const N d200
+
+.global strcmp memset start stop
+
+.boot
+lim r0 d1600
+lim r2 A
+lim r3 'a
+lim r4 N
+@leaf(.memset)
+lim r2 B
+lim r3 'a
+lim r4 N
+@leaf(.memset)
+lim r2 A
+lim r3 N
+add r2 r2 r3
+s08 r30 r2 d0
+lim r2 B
+add r2 r2 r3
+s08 r30 r2 d0
+
+@leaf(.start)
+lim r2 A
+lim r3 B
+@leaf(.byteStrcmp)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 A
+lim r3 B
+@leaf(.strcmp)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.byteStrcmp
+lim r6 d0
+lim r7 d0
+.byteStrcmpLoop
+l08 r12 r2 d0
+l08 r14 r3 d0
+bne r6 r7 d24
+beq r6 r15 d12
+adc r2 r2 r15
+adc r3 r3 r15
+beq r15 r15 d-28
+.byteStrcmpSame
+lim r2 d0
+jal r1 r1 d0
+.byteStrcmpDiff
+lim r2 d1
+bgt r6 r7 d4
+lim r2 d-1
+.byteStrcmpEnd
+jal r1 r1 d0
+
+.byteName
+"strcmp, a byte at a time: \0"
+.wordName
+"strcmp, a word at a time: \0"
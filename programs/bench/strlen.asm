@@ -0,0 +1,52 @@
+# instructions taken by strlen, against a byte at a time:
+# masm -c -o strlen.o strlen.asm ; mlink -o strlen.bin strlen.o report.o runtime.o ; vm -l strlen.bin
+
+# the calls to start and stop count the instructions run between them, see report.asm
+#!leaf      lim r1 $1 ; jal r1 r1 d0
+
+#!const STR d4096
+#!const N d200
+
+.global strlen memset start stop
+
+.boot
+lim r0 d1600
+lim r2 STR
+lim r3 'a
+lim r4 N
+@leaf(.memset)
+lim r2 STR
+lim r3 N
+add r2 r2 r3
+s08 r30 r2 d0
+
+@leaf(.start)
+lim r2 STR
+@leaf(.byteStrlen)
+lim r2 .byteName
+@leaf(.stop)
+
+@leaf(.start)
+lim r2 STR
+@leaf(.strlen)
+lim r2 .wordName
+@leaf(.stop)
+hlt
+
+.byteStrlen
+add r3 r2 r15
+lim r6 d0
+.byteStrlenLoop
+l08 r12 r3 d0
+beq r6 r15 d8
+adc r3 r3 r15
+beq r15 r15 d-16
+.byteStrlenEnd
+nor r2 r2 r2
+adc r2 r3 r2
+jal r1 r1 d0
+
+.byteName
+"strlen, a byte at a time: \0"
+.wordName
+"strlen, a half at a time: \0"
@@ -4,22 +4,15 @@
 
 #!func      s16 r1 r0 d0
 #!return    l16 r1 r0 d0 ; lim r2 d-2 ; add r0 r0 r2 ; jal r1 r1 d0
-#!call      adc r0 r0 r15 ; adc r0 r0 r15 ; jal r1 r1 d0
+#!call      lim r1 $1 ; adc r0 r0 r15 ; adc r0 r0 r15 ; jal r1 r1 d0
+#!putc      lim r2 $1 ; @call(.putchar)
 
 .boot
 lim r0 d2000
 
-lim r1 .putchar
-lim r2 'h
-@call
-
-lim r1 .putchar
-lim r2 'i
-@call
-
-lim r1 .putchar
-lim r2 d10
-@call
+@putc('h)
+@putc('i)
+@putc(d10)
 
 hlt
 
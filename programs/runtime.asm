@@ -0,0 +1,250 @@
+# guest runtime library: link runtime.o after the program's own objects, see mlink
+#
+# routines are leaves, called with 'lim r1 .name ; jal r1 r1 d0', and return with 'jal r1 r1 d0',
+# so they leave the stack (r0) alone; arguments are passed in r2, r3 and r4, and results returned in r2.
+# they clobber r2 to r14; r15 is left as the zero-register.
+#
+# memory is moved with l32/s32 four bytes at a time, and strings are searched a 16-bit half at a time:
+# (x - 0x0101) & 0x8080 is zero unless x has a zero byte, or one above 0x80, which are then looked at one by one.
+# a string routine may read up to three bytes past the end of its string.
+
+.global memcpy memset strlen strcmp puts itoa
+
+# memcpy(r2 dst, r3 src, r4 n): copies n bytes from src to dst, which mustn't overlap
+.memcpy
+lim r12 d8
+lim r13 d-8
+lim r14 d7
+blt r4 r12 d32
+.memcpy8
+l32 r3 r4 d0
+l32 r3 r5 d4
+s32 r4 r2 d0
+s32 r5 r2 d4
+add r2 r2 r12
+add r3 r3 r12
+add r4 r4 r13
+bgt r4 r14 d-32
+.memcpyWord
+lim r12 d4
+lim r13 d-1
+blt r4 r12 d24
+l32 r3 r4 d0
+s32 r4 r2 d0
+add r2 r2 r12
+add r3 r3 r12
+lim r12 d-4
+add r4 r4 r12
+.memcpyByte
+beq r4 r15 d24
+l08 r16 r3 d0
+s08 r16 r2 d0
+adc r2 r2 r15
+adc r3 r3 r15
+add r4 r4 r13
+beq r15 r15 d-28
+.memcpyEnd
+jal r1 r1 d0
+
+# memset(r2 dst, r3 byte, r4 n): fills n bytes from dst with the low byte of r3
+.memset
+lim r12 d255
+and r8 r3 r12
+lim r12 d8
+shl r9 r8 r12
+eth r8 r8 r9
+add r9 r8 r15
+lim r13 d-8
+lim r14 d7
+blt r4 r12 d20
+.memset8
+s32 r4 r2 d0
+s32 r4 r2 d4
+add r2 r2 r12
+add r4 r4 r13
+bgt r4 r14 d-20
+.memsetWord
+lim r12 d4
+lim r13 d-1
+blt r4 r12 d16
+s32 r4 r2 d0
+add r2 r2 r12
+lim r12 d-4
+add r4 r4 r12
+.memsetByte
+beq r4 r15 d16
+s08 r16 r2 d0
+adc r2 r2 r15
+add r4 r4 r13
+beq r15 r15 d-20
+.memsetEnd
+jal r1 r1 d0
+
+# strlen(r2 s): returns the number of bytes before the zero ending s
+.strlen
+add r3 r2 r15
+lim r12 d-257
+lim r13 d32896
+lim r5 d4
+lim r6 d0
+lim r14 d-1
+.strlenWord
+l32 r3 r4 d0
+add r3 r3 r5
+add r10 r8 r12
+add r11 r9 r12
+eth r10 r10 r11
+and r10 r10 r13
+beq r10 r15 d-28
+lim r7 d-4
+add r3 r3 r7
+lim r7 d4
+.strlenByte
+l08 r12 r3 d0
+beq r6 r15 d16
+adc r3 r3 r15
+add r7 r7 r14
+bne r7 r15 d-20
+beq r15 r15 d-64
+.strlenEnd
+nor r2 r2 r2
+adc r2 r3 r2
+jal r1 r1 d0
+
+# strcmp(r2 a, r3 b): returns 0 if a and b are the same, 1 if a is after b and -1 if it is before,
+# comparing the first bytes which differ
+.strcmp
+lim r12 d-257
+lim r13 d32896
+lim r5 d4
+lim r14 d-1
+lim r6 d0
+lim r7 d0
+.strcmpWord
+l32 r2 r4 d0
+l32 r3 r5 d0
+bne r8 r10 d44
+bne r9 r11 d40
+add r2 r2 r5
+add r3 r3 r5
+add r10 r8 r12
+add r11 r9 r12
+eth r10 r10 r11
+and r10 r10 r13
+beq r10 r15 d-44
+lim r4 d-4
+add r2 r2 r4
+add r3 r3 r4
+.strcmpBytes
+lim r4 d4
+.strcmpByte
+l08 r12 r2 d0
+l08 r14 r3 d0
+bne r6 r7 d32
+beq r6 r15 d20
+adc r2 r2 r15
+adc r3 r3 r15
+add r4 r4 r14
+bne r4 r15 d-32
+beq r15 r15 d-96
+.strcmpSame
+lim r2 d0
+jal r1 r1 d0
+.strcmpDiff
+lim r2 d1
+bgt r6 r7 d4
+lim r2 d-1
+.strcmpEnd
+jal r1 r1 d0
+
+# puts(r2 s): writes s to the console, storing each byte along with the write flag in one s16
+.puts
+lim r3 d1022
+lim r12 d-256
+lim r13 d8
+lim r14 d1
+lim r5 d4
+.putsWord
+l32 r2 r4 d0
+shl r10 r8 r13
+beq r10 r15 d64
+eth r10 r10 r14
+s16 r10 r3 d0
+and r10 r8 r12
+beq r10 r15 d48
+eth r10 r10 r14
+s16 r10 r3 d0
+shl r10 r9 r13
+beq r10 r15 d32
+eth r10 r10 r14
+s16 r10 r3 d0
+and r10 r9 r12
+beq r10 r15 d16
+eth r10 r10 r14
+s16 r10 r3 d0
+add r2 r2 r5
+beq r15 r15 d-76
+.putsEnd
+jal r1 r1 d0
+
+# itoa(r2 n, r3 buf): writes n in decimal to the 6 bytes at buf, and returns where its first digit is.
+# the five digits are worked out by subtracting powers of ten, then written along with the zero in two stores,
+# adding '0' to two digits at a time
+.itoa
+lim r4 d0
+lim r12 d10000
+lim r13 d-10000
+.itoa10000
+blt r2 r12 d12
+add r2 r2 r13
+adc r4 r4 r15
+beq r15 r15 d-16
+.itoa1000
+lim r5 d0
+lim r12 d1000
+lim r13 d-1000
+blt r2 r12 d12
+add r2 r2 r13
+adc r5 r5 r15
+beq r15 r15 d-16
+.itoa100
+lim r6 d0
+lim r12 d100
+lim r13 d-100
+blt r2 r12 d12
+add r2 r2 r13
+adc r6 r6 r15
+beq r15 r15 d-16
+.itoa10
+lim r7 d0
+lim r12 d10
+lim r13 d-10
+blt r2 r12 d12
+add r2 r2 r13
+adc r7 r7 r15
+beq r15 r15 d-16
+.itoaPack
+lim r12 d8
+shl r5 r5 r12
+eth r8 r4 r5
+shl r7 r7 r12
+eth r9 r6 r7
+lim r12 d12336
+add r8 r8 r12
+add r9 r9 r12
+lim r13 d48
+add r10 r2 r13
+s32 r4 r3 d0
+s16 r10 r3 d4
+add r2 r3 r15
+lim r6 d0
+lim r4 d4
+lim r14 d-1
+.itoaSkip
+l08 r12 r2 d0
+bne r6 r13 d12
+adc r2 r2 r15
+add r4 r4 r14
+bne r4 r15 d-20
+.itoaEnd
+jal r1 r1 d0
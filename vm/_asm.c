@@ -1,4 +1,5 @@
 #include "asm.h"
+#include "lex.h"
 
 enum {
     OK,
@@ -18,13 +19,37 @@ int main(int argc, char** argv) {
         }
 
         FILE* i = fopen(argv[3], "r");
-        FILE* o = fopen(argv[2], "w");
+        if (i == NULL) {
+            printf("could not open %s", argv[3]);
+            return 1;
+        }
+        long size;
+        char* src = mapFile(i, &size);
+        fclose(i);
+        if (src == NULL) {
+            printf("could not map %s", argv[3]);
+            return 1;
+        }
+        Arena arena = {NULL};
+
         int error = OK;
-        assemble(i, o, &error);
+        SymTab syms = {&arena, NULL, 0, 0};
+        Program prog = {&arena, NULL, 0, 0};
+        Buf out = {&arena, NULL, 0, 0};
+        tokenize(src, NULL, &prog, &syms, &error);
+        if (error == OK) assemble(&prog, &out, NULL, &error);
         if (error != OK) {
             printf("errored during compilation with code %i", error);
+            arenaFree(&arena);
+            unmapFile(src, size);
             return 1;
         }
+
+        FILE* o = fopen(argv[2], "w");
+        fwrite(out.data, 1, out.len, o);
+        fclose(o);
+        arenaFree(&arena);
+        unmapFile(src, size);
         return 0;
     } else {
         printf("unrecognised command %s", argv[1]);
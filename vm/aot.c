@@ -0,0 +1,55 @@
+/* LOADING TRANSLATED IMAGES */
+#include "aot.h"
+#include <dlfcn.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+AHEAD-OF-TIME TRANSLATION
+maot translates an image into C, with one function per verified block:
+    maot -o image.c image.bin
+    cc -O2 -shared -fPIC -I vm image.c -o image.so
+    vm -l image.bin -a image.so
+The module exports a Translation, naming the function each verified slot can be run by.
+It calls back into the VM for everything but registers: it is loaded into a VM built with -rdynamic -ldl,
+and is only used if it was translated from the very image loaded, for a VM with the same layout.
+Otherwise the image is interpreted as usual.
+
+Translated blocks run the same instructions as run() (see ins.h), with operands and static branch targets filled in,
+so memory is protected exactly as when interpreting, and every instruction still retires and counts.
+A cpu only runs a translated block where it would run a verified one, and where no instruction in it has since been stored over:
+the length of the verified block at a slot then covers the whole translated block.
+Jumps, and branches out of a block, go back through run(), which dispatches on the translated block at the new pc.
+*/
+
+uint64_t imageHash(char* image, long size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (long i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t)image[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+int loadTranslation(VM* vm, char* path, long size) {
+    void* module = dlopen(path, RTLD_NOW);
+    if (module == NULL) {
+        printf("COULDN'T LOAD %s, INTERPRETING INSTEAD: %s\n", path, dlerror());
+        return BAD;
+    }
+    Translation* t = dlsym(module, "translation");
+    if (t == NULL || t->version != AOT_VERSION || t->vmSize != sizeof(VM) || t->cpuSize != sizeof(CPU)) {
+        printf("%s WAS TRANSLATED FOR ANOTHER VM, INTERPRETING INSTEAD\n", path);
+        dlclose(module);
+        return BAD;
+    }
+    if (t->size != size || t->hash != imageHash(vm->mem, size)) {
+        printf("%s WAS TRANSLATED FROM ANOTHER IMAGE, INTERPRETING INSTEAD\n", path);
+        dlclose(module);
+        return BAD;
+    }
+    vm->aot = t;
+    return OK;
+}
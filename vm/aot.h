@@ -0,0 +1,43 @@
+#pragma once
+
+#include "vm.h"
+
+#define TRANSLATED 255      // opcode run() gives an instruction starting a translated block, see aot.c
+#define AOT_VERSION 4       // changes whenever translated code would behave differently
+
+// runs a translated block from *pc, leaving *pc at the last instruction run and returning its opcode
+typedef uint8_t (*Block)(CPU* cpu, uint16_t* pc);
+
+typedef struct Translation {
+    int version;            // AOT_VERSION, sizeof(VM) and sizeof(CPU) the module was compiled with
+    int vmSize;
+    int cpuSize;
+    uint64_t hash;          // of the image translated, see imageHash
+    long size;
+    uint8_t lens[65536 / 4];    // instructions translated from each slot to the end of its block, or 0
+    Block blocks[65536 / 4];    // the block each slot is translated in
+} Translation;
+
+// the state of run() which instructions use, see ins.h
+#define BLOCK_STATE \
+    VM* vm = cpu->vm; \
+    char* mem = vm->mem; \
+    uint8_t* vblock = vm->vblock; \
+    uint16_t pc = *pcp; \
+    uint16_t ctl = cpu->ctl; \
+    uint8_t* reg8 = cpu->reg8; \
+    uint16_t* reg16 = cpu->reg16; \
+    uint32_t* reg32 = cpu->reg32; \
+    int left = 0; \
+    int trusted = 1; \
+    uint32_t ints = cpu->ints; \
+    (void)vblock; (void)reg8; (void)reg32; (void)left; (void)trusted; (void)ints;
+
+// ends the block early if the instruction just run raised an interrupt
+#define CHECK_INT(op) if (cpu->ints != ints) { *pcp = pc; return op; }
+
+// moves on to the next instruction of the block, which retires as it would have in run()
+#define NEXT(addr) pc = addr; cpu->retired[mem[ctl] & (MAX_PROC - 1)]++;
+
+uint64_t imageHash(char* image, long size);
+int loadTranslation(VM* vm, char* path, long size);
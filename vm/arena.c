@@ -0,0 +1,51 @@
+/* TOOLCHAIN ARENA ALLOCATOR */
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ARENAS
+Everything the preprocessor and assembler allocate during a run (symbols, their names and definitions, file buffers)
+comes out of one arena, which hands memory out of large chunks and is released all at once by arenaFree.
+Nothing is freed individually.
+*/
+
+#define CHUNK_SIZE 65536
+
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    Chunk* chunk = arena->head;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        size_t csize = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunk = malloc(sizeof(Chunk) + csize);
+        chunk->size = csize;
+        chunk->used = 0;
+        // a large allocation goes behind the current chunk, which may still have room
+        if (arena->head != NULL && csize > CHUNK_SIZE) {
+            chunk->next = arena->head->next;
+            arena->head->next = chunk;
+        } else {
+            chunk->next = arena->head;
+            arena->head = chunk;
+        }
+    }
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void* arenaZalloc(Arena* arena, size_t size) {
+    void* ptr = arenaAlloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void arenaFree(Arena* arena) {
+    Chunk* chunk = arena->head;
+    while (chunk != NULL) {
+        Chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
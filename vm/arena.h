@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct Chunk {
+    struct Chunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} Chunk;
+
+typedef struct {
+    Chunk* head;
+} Arena;
+
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaZalloc(Arena* arena, size_t size);
+void arenaFree(Arena* arena);
@@ -1,5 +1,6 @@
 /* VM ASSEMBLER */
 #include "asm.h"
+#include "compress.h"
 
 enum {
     OK,
@@ -16,393 +17,160 @@ enum {
 #define i32 int32_t
 #define i64 int64_t
 
-enum INS_TKN {
-    HLT,
-
-    LIM,
-
-    LD8,
-    LD16,
-    LD32,
-
-    SV8,
-    SV16,
-    SV32,
-
-    AND,
-    OR,
-    XOR,
-    NOR,
-
-    ADD,
-    ADDC,
-    SHIFTL,
-    SHIFTR,
-
-    LJAL,
-    BEQ,
-    BNE,
-    BLT,
-    BGT,
-    INT
-};
-
-enum INS_TYPE {
-    UNARY,
-    REG_IMM16,
-    REG2_IMM8,
-    REG3,
-    IMM8x2,
-};
-
-typedef struct {
-    char op;
-    char a1;
-    char a2;
-    char a3;
-} Ins;
-
-int insType[] = {
-    HLT, UNARY,
-
-    LIM, REG_IMM16,
-
-    LD8, REG2_IMM8,
-    LD16, REG2_IMM8,
-    LD32, REG2_IMM8,
-
-    SV8, REG2_IMM8,
-    SV16, REG2_IMM8,
-    SV32, REG2_IMM8,
-
-    AND, REG3,
-    OR, REG3,
-    XOR, REG3,
-    NOR, REG3,
-
-    ADD, REG3,
-    ADDC, REG3,
-    SHIFTL, REG3,
-    SHIFTR, REG3,
-
-    LJAL, REG2_IMM8,
-    BEQ, REG2_IMM8,
-    BNE, REG2_IMM8,
-    BLT, REG2_IMM8,
-    BGT, REG2_IMM8,
-
-    INT, IMM8x2
-};
-
-char* toks[] = {
-    "hlt", HLT,
-    "lim", LIM,
-    "l08", LD8,
-    "l16", LD16,
-    "l32", LD32,
-    "s08", SV8,
-    "s16", SV16,
-    "s32", SV32,
-
-    "and", AND,
-    "eth", OR,
-    "xor", XOR,
-    "nor", NOR,
-
-    "add", ADD,
-    "adc", ADDC,
-    "shl", SHIFTL,
-    "shr", SHIFTR,
+/*
+ASSEMBLER
+Items are encoded in a single pass over the program. An operand naming a label which has already been placed
+is encoded directly; otherwise a fixup is recorded, and the field is patched once every label has been placed.
+The same goes for expressions using labels.
+When assembling an object file, every operand using a label is left as a fixup for the linker instead, see obj.c.
+Reserved zeros are counted rather than written, until something follows them (see ir.c).
+*/
+
+int operandValue(Item* item, int o, int* value, int final) {
+    switch (item->opkind[o]) {
+    case OPND_SYM:
+        if (item->ops[o].sym->pos < 0) {
+            if (!final) return EVAL_PENDING;
+            toolPrintf("FATAL: LABEL \"%s\" NOT FOUND, ON LINE %i.\n", item->ops[o].sym->name, item->line);
+            return EVAL_BAD;
+        }
+        *value = item->ops[o].sym->pos;
+        return EVAL_OK;
+    case OPND_EXPR:
+        return evalExpr(item->ops[o].expr, value, final, item->line, 0);
+    default:
+        *value = item->ops[o].imm;
+        return EVAL_OK;
+    }
+}
 
-    "jal", LJAL,
-    "beq", BEQ,
-    "bne", BNE,
-    "blt", BLT,
-    "bgt", BGT,
-    "int", INT,
-    "nop", 64,
-};
+void patch(Buf* out, int at, int size, int value) {
+    for (int b = 0; b < size; b++) out->data[at + b] = (value >> 8*b) & 0xff;
+}
 
-int getInsType(int op) {
-    for (int i = 0; i < sizeof(insType)/sizeof(insType[0]); i += 2) {
-        if (op == insType[i]) return insType[i+1];
+// records that a field must be patched once the labels it uses have been placed
+void addFixup(Program* prog, Relocs* fixups, int* cap, Fixup f) {
+    if (fixups->count == *cap) {
+        *cap = *cap == 0 ? 256 : *cap * 2;
+        Fixup* grown = arenaAlloc(prog->arena, *cap * sizeof(Fixup));
+        if (fixups->count) memcpy(grown, fixups->fixups, fixups->count * sizeof(Fixup));
+        fixups->fixups = grown;
     }
-    return UNARY;
+    fixups->fixups[fixups->count++] = f;
 }
 
-int stoi(char* str, int* err) {
-    *err = OK;
-    int acc = 0;
-    int neg_flag = 0;
-    int i = 0;
-    if (str[0] == '-') {
-        neg_flag = 1;
-        i = 1;
-    }
-    for (;;i++) {
-        if (str[i] == 0) {
-            break;
-        }
-        int d = str[i] - '0';
-        if (d < 0 || d > 9) {
-            *err = BAD;
-            return 0;
-        }
-        acc = acc * 10 + d;
-    }
-    if (neg_flag) {
-        return -acc;
+// encodes one field of an item, or leaves it to a fixup
+int encodeField(Program* prog, Buf* out, Relocs* fixups, int* cap, int object, Item* item, int o, int at, int size) {
+    int value;
+    int st = object && item->opkind[o] >= OPND_SYM ? EVAL_PENDING : operandValue(item, o, &value, 0);
+    if (st == EVAL_OK) {
+        patch(out, at, size, value);
+    } else if (st == EVAL_PENDING) {
+        addFixup(prog, fixups, cap, (Fixup){at, size, item, o});
     } else {
-        return acc;
+        return BAD;
     }
+    return OK;
 }
 
-int btoi(char* str, int* err) { // doesn't work??
+// assembles a program into out, returning where it ends, counting the reserved zeros left off the end of out.
+// if relocs is given, label operands are left to it rather than patched
+int assemble(Program* prog, Buf* out, Relocs* relocs, int* err) {
     *err = OK;
-    int acc = 0;
-    for (int i = 0;;i++) {
-        if (str[i] == 0) {
-            break;
+    bufPut(out, "", 0);
+    Relocs fixups = {NULL, 0};
+    int cap = 0;
+    int reserved = 0;
+
+    for (int i = 0; i < prog->count; i++) {
+        Item* item = &prog->items[i];
+        if (isReserved(item)) {
+            reserved += itemSize(item, out->len + reserved);
+            continue;
         }
-        int d = str[i] - '0';
-        if (d != 0 && d != 1) {
-            *err = BAD;
-            return 0;
+        if (item->kind == ITEM_LABEL) {
+            if (item->label->pos >= 0) {
+                toolPrintf("FATAL: LABEL \"%s\" DEFINED TWICE, ON LINE %i.\n", item->label->name, item->line);
+                *err = BAD;
+                return 0;
+            }
+            item->label->pos = out->len + reserved;
+            continue;
         }
-        acc = acc * 2 + d;
-    }
-    return acc;
-}
+        bufZero(out, reserved);
+        reserved = 0;
 
-int inseq(char* a, char* b) {
-    return (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]);
-}
+        switch (item->kind) {
+        case ITEM_DATA:
+            bufPut(out, item->data, item->len);
+            break;
 
-int classifyIns(char a, char b, char c, int* err) {
-    *err = OK;
-    char str[] = {a, b, c};
-    for (int i = 0; i < sizeof(toks)/sizeof(toks[0]); i += 2) {
-        if (inseq(str, toks[i])) {
-            return (int)toks[i+1];
+        case ITEM_VALUE: {
+            int at = out->len;
+            bufZero(out, item->op);
+            if (encodeField(prog, out, &fixups, &cap, relocs != NULL, item, 0, at, item->op) != OK) {
+                *err = BAD;
+                return 0;
+            }
+            break;
         }
-    }
-    *err = BAD;
-    return 0;
-}
 
-int parseRegister(char* op, int* err) {
-    *err = OK;
-    if (op[0] != 'r') {
-        *err = 1;
-        return 0;
-    }
-    int te = 0;
-    int n = stoi(op + 1, &te);
-    if (te != OK) {
-        *err = BAD;
-        return 0;
-    }
-    if (te < 0 || te > 31) {
-        *err = BAD;
-        return 0;
-    }
-    return n;
-}
-
-int parseImm(char* op, int* err) {
-    *err = OK;
-    if (op[0] == 'd') {
-        return stoi(op+1, err);
-    }
-    if (op[0] == '\'') {
-        return op[1];
-    }
-    if (op[0] == 'b') {
-        return btoi(op+1, err);
-    }
-    *err = BAD;
-    return 0;
-}
-
-int splitChar(char delim, char* str, char** strs) {
-    for (int i = 0, l = 0, c = 0;;i++) {
-        if (str[i] == 0) {
-            strs[l][c] = 0;
+        case ITEM_INS: {
+            if (!checkOperands(item)) {
+                toolPrintf("FATAL: BAD OPERANDS ON LINE %i.\n", item->line);
+                *err = BAD;
+                return 0;
+            }
+            int count;
+            int o = badRegister(item, &count);
+            if (o >= 0) {
+                toolPrintf("FATAL: r%i IS NOT ONE OF THE %i %i-BIT REGISTERS, ON LINE %i.\n", item->ops[o].imm, count, 256 / count, item->line);
+                *err = BAD;
+                return 0;
+            }
+            char bytes[4] = {item->op, 0, 0, 0};
+            int at = out->len;
+            bufPut(out, bytes, 4);
+            int wide = getInsType(item->op) == REG_IMM16;
+            for (int o = 0; o < item->nops; o++) {
+                if (encodeField(prog, out, &fixups, &cap, relocs != NULL, item, o, at + 1 + o, wide && o == 1 ? 2 : 1) != OK) {
+                    *err = BAD;
+                    return 0;
+                }
+            }
+            if (item->half) {
+                // compressed instructions only have numbers for operands, so are complete by now
+                compressIns((uint8_t*)out->data + at, out->data + at);
+                out->len -= 2;
+                out->data[out->len] = 0;
+            }
             break;
         }
-        if (str[i] == delim) {
-            strs[l][c] = 0;
-            l++;
-            i++;
-            c = 0;
         }
-        strs[l][c] = str[i];
-        c++;
-    }
-    return OK;
-}
-
-Ins parseIns(char* line, int* err) {
-    Ins tmp = {0, 0, 0, 0};
-    tmp.op = classifyIns(line[0], line[1], line[2], err);
-    if (*err == BAD) return tmp;
-    char op1[256];
-    char op2[256];
-    char op3[256];
-    char* operands[] = {
-        op1,
-        op2,
-        op3,
-    };
-    *err = splitChar(' ', line + 4, operands);
-    if (*err == BAD) return tmp;
-    switch (getInsType(tmp.op))
-    {
-    case UNARY:
-        return tmp;
-    
-    case REG_IMM16:
-        tmp.a1 = parseRegister(operands[0], err);
-        if (*err == BAD) return tmp;
-        i16 imm[1];
-        imm[0] = parseImm(operands[1], err);
-        i8* imm8 = imm;
-        tmp.a2 = imm8[0];
-        tmp.a3 = imm8[1];
-        return tmp;
-    
-    case REG2_IMM8:
-        tmp.a1 = parseRegister(operands[0], err);
-        if (*err == BAD) return tmp;
-        tmp.a2 = parseRegister(operands[1], err);
-        if (*err == BAD) return tmp;
-        tmp.a3 = parseImm(operands[2], err);
-        return tmp;
-
-    case REG3:
-        tmp.a1 = parseRegister(operands[0], err);
-        if (*err == BAD) return tmp;
-        tmp.a2 = parseRegister(operands[1], err);
-        if (*err == BAD) return tmp;
-        tmp.a3 = parseRegister(operands[2], err);
-        return tmp;
-    
-    case IMM8x2:
-        tmp.a1 = parseImm(operands[0], err);
-        if (*err == BAD) return tmp;
-        tmp.a2 = parseImm(operands[1], err);
-        return tmp;
-
-    default:
-        printf("Something has gone seriously wrong...\n");
-        *err = BAD;
-        return tmp;
     }
-}
 
-int parseStrData(char* str, char* buf, int* err) {
-    *err = OK;
-    if (str[0] != '"') {
+    if (out->len + reserved > 65536) {
+        toolPrintf("FATAL: PROGRAM NEEDS %li BYTES OF MEMORY.\n", out->len + reserved);
         *err = BAD;
         return 0;
     }
-    int c = 0;
-    for(int i = 1;;i++) {
-        if (str[i] == '"') {
-            break;
-        } else if (str[i] == 0) {
+    if (relocs != NULL) {
+        *relocs = fixups;
+        return out->len + reserved;
+    }
+
+    for (int f = 0; f < fixups.count; f++) {
+        int value;
+        if (operandValue(fixups.fixups[f].item, fixups.fixups[f].o, &value, 1) != EVAL_OK) {
             *err = BAD;
             return 0;
-        } else if (str[i] == '\\') {
-            i++;
-            switch(str[i]) {
-            case '0':
-                buf[c] = 0; break;
-            case 'n':
-                buf[c] = '\n'; break;
-            default:
-                buf[c] = str[i]; break;
-            }
-        } else {
-            buf[c] = str[i];
         }
-        c++;
-    }
-    return c;
-}
-
-int parseLine(char* line, char* buf, int* err) {
-    *err = OK;
-    if (line[0] == '"') {
-        return parseStrData(line, buf, err);
-    } else {
-        Ins tmp = parseIns(line, err);
-        if (*err != OK) {
+        if (!fitsField(value, fixups.fixups[f].size)) {
+            toolPrintf("FATAL: %i DOESN'T FIT IN %i BYTES, ON LINE %i.\n", value, fixups.fixups[f].size, fixups.fixups[f].item->line);
+            *err = BAD;
             return 0;
         }
-        buf[0] = tmp.op;
-        buf[1] = tmp.a1;
-        buf[2] = tmp.a2;
-        buf[3] = tmp.a3;
-        return 4;
+        patch(out, fixups.fixups[f].at, fixups.fixups[f].size, value);
     }
+    return out->len + reserved;
 }
-
-void assemble(FILE* in, FILE* out, int* err) {
-    *err = OK;
-    int read = 0;
-    char readc = 0;
-
-    char eof_flag = 0;
-
-    int i = 0;
-    for (;;i++) {
-        int read;
-        char readc;
-        for (;;) {
-            read = getc(in);
-            if (read == EOF) {
-                eof_flag = 1;
-                break;
-            }
-            readc = (char)read;
-            if (!(readc == '\n' || isspace(readc))) { // parse extra lines/whitespace
-                break;
-            }
-        }
-
-        if (eof_flag) {
-            break;
-        }
-
-        char linebuf[256];
-        int linelen = 0;
-        
-        for (;;) {
-            if (read == EOF) {
-                eof_flag = 1;
-                break;
-            }
-            if (readc == '\n') {
-                break;
-            }
-            
-            linebuf[linelen] = readc;
-            linelen++;
-            read = getc(in);
-            readc = (char)read;
-        }
-
-        linebuf[linelen] = 0;
-        char outbuf[256];
-        int outlen = parseLine(linebuf, outbuf, err);
-        if (*err != OK) {
-            return;
-        }
-
-        for(int i = 0; i < outlen;i++) {
-            putc(outbuf[i], out);
-        }
-    }
-    *err = OK;
-}
\ No newline at end of file
@@ -1,4 +1,19 @@
+#pragma once
+
 #include <stdint.h>
 #include <stdio.h>
+#include "ir.h"
+
+typedef struct {
+    int at;         // offset of the field in the output
+    int size;       // size of the field in bytes
+    Item* item;
+    int o;          // which operand of the item
+} Fixup;
+
+typedef struct {
+    Fixup* fixups;
+    int count;
+} Relocs;
 
-void assemble(FILE* in, FILE* out, int* err);
\ No newline at end of file
+int assemble(Program* prog, Buf* out, Relocs* relocs, int* err);
\ No newline at end of file
@@ -0,0 +1,107 @@
+/* TOOLCHAIN BUFFERS */
+#include "buf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum {
+    OK,
+    BAD
+};
+
+__thread FILE* toolOut;
+
+/*
+BUFFERS
+The preprocessor and assembler pass their output to each other in memory, through growable buffers.
+A buffer doubles when full, leaving its old contents behind in the arena, so at most twice its final size is wasted.
+*/
+
+// makes room for len more bytes at the end of a buffer, returning where they go
+char* bufExtend(Buf* buf, long len) {
+    if (buf->len + len + 1 > buf->cap) {
+        long cap = buf->cap < 256 ? 256 : buf->cap;
+        while (buf->len + len + 1 > cap) cap *= 2;
+        char* grown = arenaAlloc(buf->arena, cap);
+        if (buf->len) memcpy(grown, buf->data, buf->len);
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    char* at = buf->data + buf->len;
+    buf->len += len;
+    buf->data[buf->len] = 0;
+    return at;
+}
+
+void bufPut(Buf* buf, const char* data, long len) {
+    memcpy(bufExtend(buf, len), data, len);
+}
+
+void bufZero(Buf* buf, long len) {
+    memset(bufExtend(buf, len), 0, len);
+}
+
+void bufPutc(Buf* buf, char c) {
+    bufPut(buf, &c, 1);
+}
+
+/*
+MAPPED INPUT
+Source files are mapped rather than read, privately so that the toolchain may scribble on them.
+The toolchain expects NUL-terminated text, so an anonymous mapping one byte longer than the file is reserved first
+and the file mapped over its start: the byte after the file is then either the zeroed tail of the file's last page,
+or the first byte of the anonymous page after it.
+*/
+
+char* mapFile(FILE* in, long* size) {
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    char* data = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    if (st.st_size > 0 && mmap(data, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(in), 0) == MAP_FAILED) {
+        munmap(data, st.st_size + 1);
+        return NULL;
+    }
+    *size = st.st_size;
+    return data;
+}
+
+void unmapFile(char* data, long size) {
+    munmap(data, size + 1);
+}
+
+/*
+ATOMIC OUTPUT
+Outputs are written to a fresh temporary file beside them, which is then renamed over them,
+so that anything reading an output never sees it half-written, even while it is being rebuilt,
+and a failed write leaves the old output, if any, as it was.
+*/
+
+int writeAtomically(char* path, char* data, long len) {
+    long n = strlen(path);
+    char* tmp = malloc(n + 8);
+    memcpy(tmp, path, n);
+    memcpy(tmp + n, ".XXXXXX", 8);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return BAD;
+    }
+    int status = fchmod(fd, 0644) == 0 ? OK : BAD;
+    for (long done = 0; status == OK && done < len;) {
+        long wrote = write(fd, data + done, len - done);
+        if (wrote <= 0) status = BAD;
+        else done += wrote;
+    }
+    if (close(fd) != 0) status = BAD;
+    if (status == OK && rename(tmp, path) != 0) status = BAD;
+    if (status != OK) unlink(tmp);
+    free(tmp);
+    return status;
+}
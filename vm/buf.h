@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+#include "arena.h"
+
+typedef struct {
+    Arena* arena;   // where the contents live
+    char* data;     // always kept NUL-terminated
+    long len;
+    long cap;
+} Buf;
+
+char* bufExtend(Buf* buf, long len);
+void bufPut(Buf* buf, const char* data, long len);
+void bufZero(Buf* buf, long len);
+void bufPutc(Buf* buf, char c);
+// the toolchain's messages go to stdout, or to toolOut if the thread building has set one, see masm.c
+extern __thread FILE* toolOut;
+#define toolPrintf(...) fprintf(toolOut != NULL ? toolOut : stdout, __VA_ARGS__)
+
+char* mapFile(FILE* in, long* size);
+void unmapFile(char* data, long size);
+int writeAtomically(char* path, char* data, long len);
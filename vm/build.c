@@ -0,0 +1,79 @@
+/* TOOLCHAIN DRIVER */
+#include "build.h"
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+BUILDS
+Everything one build needs lives in its own arena, so that any number of builds can run at once in one process.
+Outputs are written atomically, see buf.c.
+*/
+
+// preprocesses and assembles NUL-terminated source into out
+void buildSource(char* src, Arena* arena, Buf* out, int flags, int* err) {
+    SymTab syms = {arena, NULL, 0, 0};
+    Program prog = {arena, NULL, 0, 0};
+    preprocess(src, &syms, &prog, err);
+    if (*err != OK) {
+        toolPrintf("errored during preprocessing with code %i\n", *err);
+        return;
+    }
+
+    if (flags & BUILD_OPTIMIZE) {
+        int removed = optimize(&prog);
+        if (flags & BUILD_VERBOSE) toolPrintf("OPTIMIZER REMOVED %i INSTRUCTIONS\n", removed);
+    }
+
+    if (flags & BUILD_COMPRESS) {
+        int pairs = compress(&prog);
+        if (flags & BUILD_VERBOSE) toolPrintf("COMPRESSED %i PAIRS OF INSTRUCTIONS\n", pairs);
+    }
+
+    if (flags & BUILD_OBJECT) writeObject(&prog, out, err);
+    else assemble(&prog, out, NULL, err);
+    if (*err != OK) {
+        toolPrintf("errored during assembly with code %i\n", *err);
+        return;
+    }
+    if (flags & BUILD_VERBOSE) {
+        toolPrintf("OUTPUT FILE SIZE (bytes): %li\n", out->len);
+        if (syms.count != 0) {
+            toolPrintf("SYMBOLS DETECTED:\n");
+            debug_print_Syms(&syms);
+        }
+    }
+}
+
+// builds one source file into an output file, returning 0 if it succeeded
+int buildFile(char* in, char* out, int flags) {
+    FILE* i = fopen(in, "r");
+    if (i == NULL) {
+        toolPrintf("could not open %s\n", in);
+        return 1;
+    }
+    long size;
+    char* src = mapFile(i, &size);
+    fclose(i);
+    if (src == NULL) {
+        toolPrintf("could not map %s\n", in);
+        return 1;
+    }
+
+    Arena arena = {NULL};
+    int error = OK;
+    Buf bin = {&arena, NULL, 0, 0};
+    buildSource(src, &arena, &bin, flags, &error);
+    int status = 0;
+    if (error != OK) {
+        status = 1;
+    } else if (writeAtomically(out, bin.data, bin.len) != OK) {
+        toolPrintf("could not write %s\n", out);
+        status = 1;
+    }
+    arenaFree(&arena);
+    unmapFile(src, size);
+    return status;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "asm.h"
+#include "pre.h"
+#include "opt.h"
+#include "obj.h"
+
+#define BUILD_OPTIMIZE 1    // run the peephole optimizer, see opt.c
+#define BUILD_OBJECT 2      // write an object file rather than an image, see obj.c
+#define BUILD_VERBOSE 4     // print sizes and symbols
+#define BUILD_COMPRESS 8    // use 16-bit instructions where they fit, see compress.c
+
+void buildSource(char* src, Arena* arena, Buf* out, int flags, int* err);
+int buildFile(char* in, char* out, int flags);
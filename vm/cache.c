@@ -0,0 +1,147 @@
+/* COMPILED IMAGE CACHE */
+#include "cache.h"
+#include "build.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+IMAGE CACHE
+vm -r runs an assembly source directly, assembling it in-process. Images are kept in $XDG_CACHE_HOME/rofth,
+or ~/.cache/rofth, under a 64-bit FNV-1a hash of the source, which holds all of its macro definitions, and of
+the vm binary, which holds the whole toolchain, so that running an unchanged source again with an unchanged vm
+skips the toolchain altogether. Hashing the binary costs well under a millisecond.
+A cached image is mapped privately straight into the VM's memory; the rest of memory stays zeroed,
+which is all that the reserved zeros left off the end of an image need (see ir.c).
+*/
+
+#define CACHE_VERSION "rofth image cache 2"
+
+uint64_t hash64(uint64_t hash, const char* data, long len) {
+    for (long i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// a cache which can't be used only costs each run a build, so this is only said once
+void cacheFailed(char* path) {
+    static int warned;
+    if (!warned) {
+        printf("COULDN'T CACHE IN %s, BUILDING EVERY RUN INSTEAD: %s\n", path, strerror(errno));
+        warned = 1;
+    }
+}
+
+// a hash of the vm binary, which holds the toolchain, or 0 if it can't be read
+uint64_t toolchainHash() {
+    FILE* exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) return 0;
+    long size;
+    char* bin = mapFile(exe, &size);
+    fclose(exe);
+    if (bin == NULL) return 0;
+    uint64_t hash = hash64(14695981039346656037ull, CACHE_VERSION, sizeof(CACHE_VERSION));
+    hash = hash64(hash, bin, size);
+    unmapFile(bin, size);
+    return hash;
+}
+
+// creates dir, and any of its parents which don't exist yet
+int makeDirs(char* dir) {
+    for (char* p = dir + 1; *p != 0; p++) {
+        if (*p == '/') {
+            *p = 0;
+            int made = mkdir(dir, 0755) == 0 || errno == EEXIST;
+            *p = '/';
+            if (!made) return BAD;
+        }
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST ? OK : BAD;
+}
+
+// the cached image of a source, creating the cache directory if need be
+char* cachePath(uint64_t key) {
+    char* base = getenv("XDG_CACHE_HOME");
+    char* home = getenv("HOME");
+    char* dir = malloc(4096);
+    if (base != NULL && base[0] != 0) {
+        snprintf(dir, 4096, "%s/rofth", base);
+    } else if (home != NULL) {
+        snprintf(dir, 4096, "%s/.cache/rofth", home);
+    } else {
+        free(dir);
+        return NULL;
+    }
+    if (makeDirs(dir) != OK) {
+        cacheFailed(dir);
+        free(dir);
+        return NULL;
+    }
+    long len = strlen(dir);
+    snprintf(dir + len, 4096 - len, "/%016llx.bin", (unsigned long long)key);
+    return dir;
+}
+
+// maps a cached image over the start of mem, returning its size, or -1 if there isn't one
+long mapCached(char* path, char* mem) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    long size = -1;
+    if (fstat(fd, &st) == 0 && st.st_size <= 65536) {
+        size = st.st_size;
+        if (size > 0 && mmap(mem, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) size = -1;
+    }
+    close(fd);
+    return size;
+}
+
+// loads the image of an assembly source into mem, returning its size, or -1 if it could not be built
+long loadSource(char* path, char* mem) {
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        printf("could not open %s\n", path);
+        return -1;
+    }
+    long size;
+    char* src = mapFile(in, &size);
+    fclose(in);
+    if (src == NULL) {
+        printf("could not map %s\n", path);
+        return -1;
+    }
+
+    // without the toolchain's hash, an image can't be told apart from one built by another vm
+    uint64_t key = toolchainHash();
+    char* cached = NULL;
+    if (key != 0) {
+        cached = cachePath(hash64(key, src, size));
+    }
+    long len = cached == NULL ? -1 : mapCached(cached, mem);
+    if (len < 0) {
+        Arena arena = {NULL};
+        Buf bin = {&arena, NULL, 0, 0};
+        int err = OK;
+        buildSource(src, &arena, &bin, 0, &err);
+        if (err == OK) {
+            if (cached != NULL && writeAtomically(cached, bin.data, bin.len) != OK) {
+                cacheFailed(cached);
+            }
+            memcpy(mem, bin.data, bin.len);
+            len = bin.len;
+        }
+        arenaFree(&arena);
+    }
+    free(cached);
+    unmapFile(src, size);
+    return len;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+long loadSource(char* path, char* mem);
@@ -0,0 +1,216 @@
+/* VM MESSAGE CHANNELS */
+#include "chn.h"
+#include "verify.h"
+#include "snap.h"
+#include <stdlib.h>
+
+/*
+MESSAGE CHANNELS
+A channel is a named queue of CHN_SLOTS messages, each up to CHN_SLOT bytes long.
+Messages are kept by the VM outside of the 64KB guest memory, and are copied in and out
+in a single step, after checking the whole buffer against the segments of the process which owns it.
+
+The OS drives the device through the registers at address CHN (see vm.h):
+write CHN_ID, CHN_PRC, CHN_ADDR and CHN_LEN as needed, then the command to CHN_CMD.
+The command is carried out after the instruction which wrote it, its status is left in CHN_STS,
+and CHN_CMD is cleared.
+
+commands:
+OPEN    open (or create) the channel named by the zero-terminated string at CHN_ADDR, returning its number in CHN_ID
+SEND    queue the CHN_LEN bytes at CHN_ADDR onto channel CHN_ID
+RECV    dequeue the oldest message on channel CHN_ID to CHN_ADDR, returning its length in CHN_LEN
+WAIT    request interrupt CHN_INT once channel CHN_ID has a message in it;
+        the channel's bit is then set in CHN_WAKE, which the OS should clear.
+
+Device interrupts go to cpu 0, and are only delivered while a user process is running there,
+as the OS can't be re-entered.
+*/
+
+#define CHN_MAX 16
+#define CHN_SLOTS 8
+#define CHN_SLOT 256
+#define CHN_NAME 16
+
+enum CHN_COMMAND {
+    CHN_NONE,
+    CHN_OPEN,
+    CHN_SEND,
+    CHN_RECV,
+    CHN_WAIT,
+};
+
+enum CHN_STATUS {
+    CHN_OK,
+    CHN_BADCMD,
+    CHN_BADID,
+    CHN_FAULT,
+    CHN_FULL,
+    CHN_EMPTY,
+    CHN_TOOLONG,
+};
+
+typedef struct {
+    char name[CHN_NAME];
+    int head;
+    int count;
+    int waiting;
+    uint16_t len[CHN_SLOTS];
+    char slot[CHN_SLOTS][CHN_SLOT];
+} Channel;
+
+// allocated on the first command, so that VMs which don't use channels don't pay for them
+typedef struct Channels {
+    Channel chans[CHN_MAX];
+    int nchans;
+} Channels;
+
+// checks every segment a buffer touches, and for a write every byte of it against PERF,
+// so that it can be copied without further checks
+int isRangeLegal(VM* vm, uint16_t unaddr, uint16_t len, uint8_t prc, int write) {
+    char* mem = vm->mem;
+    if (len == 0) return 1;
+    uint16_t addr = OFFSET(prc) + unaddr;
+    if (unaddr + len > 65536 || addr + len > 65536) return 0;
+    uint16_t last = addr + len - 1;
+    for (int seg = addr / SEG_SIZE; seg <= last / SEG_SIZE; seg++) {
+        uint16_t segaddr = seg == addr / SEG_SIZE ? addr : seg * SEG_SIZE;
+        int seglen = (seg == last / SEG_SIZE ? last : seg * SEG_SIZE + SEG_SIZE - 1) - segaddr + 1;
+        if (write ? !isWriteable(vm, unaddr + len - 1, segaddr, seglen, prc) : !isReadable(vm, segaddr, prc)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int openChannel(VM* vm, uint16_t unaddr, uint8_t prc, int* status) {
+    char* mem = vm->mem;
+    Channels* chn = vm->chn;
+    char name[CHN_NAME];
+    uint16_t addr = OFFSET(prc) + unaddr;
+    int len = 0;
+    for (;;len++) {
+        if (len == CHN_NAME) {
+            *status = CHN_TOOLONG;
+            return 0;
+        }
+        if (!isReadable(vm, addr + len, prc)) {
+            *status = CHN_FAULT;
+            return 0;
+        }
+        name[len] = mem[(uint16_t)(addr + len)];
+        if (name[len] == 0) break;
+    }
+    for (int i = 0; i < chn->nchans; i++) {
+        if (strcmp(name, chn->chans[i].name) == 0) return i;
+    }
+    if (chn->nchans == CHN_MAX) {
+        *status = CHN_FULL;
+        return 0;
+    }
+    memcpy(chn->chans[chn->nchans].name, name, len + 1);
+    return chn->nchans++;
+}
+
+void command(VM* vm) {
+    char* mem = vm->mem;
+    Channels* chn = vm->chn;
+    uint8_t cmd = mem[CHN_CMD];
+    uint8_t id = mem[CHN_ID];
+    uint8_t prc = mem[CHN_PRC] % MAX_PROC;
+    uint16_t unaddr = *(uint16_t*)(mem + CHN_ADDR);
+    uint16_t len = *(uint16_t*)(mem + CHN_LEN);
+    int status = CHN_OK;
+
+    if (cmd != CHN_OPEN && id >= chn->nchans) {
+        mem[CHN_STS] = CHN_BADID;
+        mem[CHN_CMD] = CHN_NONE;
+        return;
+    }
+    Channel* chan = chn->chans + id;
+
+    switch (cmd)
+    {
+    case CHN_OPEN: {
+        int n = openChannel(vm, unaddr, prc, &status);
+        if (status == CHN_OK) {
+            mem[CHN_ID] = n;
+        }
+        break;
+    }
+
+    case CHN_SEND: {
+        if (len > CHN_SLOT) {
+            status = CHN_TOOLONG;
+        } else if (chan->count == CHN_SLOTS) {
+            status = CHN_FULL;
+        } else if (!isRangeLegal(vm, unaddr, len, prc, 0)) {
+            status = CHN_FAULT;
+        } else {
+            int tail = (chan->head + chan->count) % CHN_SLOTS;
+            memcpy(chan->slot[tail], mem + (uint16_t)(OFFSET(prc) + unaddr), len);
+            chan->len[tail] = len;
+            chan->count++;
+            if (chan->waiting) {
+                chan->waiting = 0;
+                *(uint16_t*)(mem + CHN_WAKE) |= 1 << id;
+                raiseInt(vm, 0, CHN_INT);
+            }
+        }
+        break;
+    }
+
+    case CHN_RECV: {
+        if (chan->count == 0) {
+            status = CHN_EMPTY;
+            break;
+        }
+        uint16_t mlen = chan->len[chan->head];
+        if (!isRangeLegal(vm, unaddr, mlen, prc, 1)) {
+            status = CHN_FAULT;
+        } else {
+            memcpy(mem + (uint16_t)(OFFSET(prc) + unaddr), chan->slot[chan->head], mlen);
+            unverify(vm, OFFSET(prc) + unaddr, mlen);
+            // a message is no longer than a page, so spans at most two
+            DIRTY(vm, OFFSET(prc) + unaddr, mlen);
+            *(uint16_t*)(mem + CHN_LEN) = mlen;
+            chan->head = (chan->head + 1) % CHN_SLOTS;
+            chan->count--;
+        }
+        break;
+    }
+
+    case CHN_WAIT: {
+        if (chan->count != 0) {
+            *(uint16_t*)(mem + CHN_WAKE) |= 1 << id;
+            raiseInt(vm, 0, CHN_INT);
+        } else {
+            chan->waiting = 1;
+        }
+        break;
+    }
+
+    default:
+        status = CHN_BADCMD;
+        break;
+    }
+
+    mem[CHN_STS] = status;
+    mem[CHN_CMD] = CHN_NONE;
+}
+
+void chnStep(VM* vm) {
+    pthread_mutex_lock(&vm->chnLock);
+    if (vm->chn == NULL) {
+        vm->chn = calloc(1, sizeof(Channels));
+    }
+    // another cpu may have carried the command out already
+    if (vm->mem[CHN_CMD] != CHN_NONE) {
+        command(vm);
+    }
+    pthread_mutex_unlock(&vm->chnLock);
+}
+
+void chnFree(VM* vm) {
+    free(vm->chn);
+    vm->chn = NULL;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "vm.h"
+
+void chnStep(VM* vm);
+void chnFree(VM* vm);
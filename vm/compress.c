@@ -0,0 +1,57 @@
+/* 16-BIT INSTRUCTIONS */
+#include "vm.h"
+#include "compress.h"
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+COMPRESSED INSTRUCTIONS
+The most common forms of instructions also have a 16-bit encoding, marked by the high bit of its first byte,
+which no opcode uses. Each stands for exactly one 32-bit instruction, and runs just as it would:
+    1fff aaaa bbbbbbbb
+where fff is the form, and a and b are expanded into the operands of the instruction, as listed in compress.h.
+They cover small LIMs, moves, two-address arithmetic, loads and stores to the stack at r0,
+branches comparing with the zero register r15, and jumps to a register.
+
+Offsets are relative to the end of an instruction, whichever size it is:
+a 16-bit branch goes to its address + offset + 2, and a 16-bit jump links the address after it.
+A 16-bit instruction ending a block, or trapping, returns to the instruction right after it, as a 32-bit one does.
+
+With masm -z, the assembler picks the 16-bit encoding by itself, in pairs, so that every 32-bit instruction,
+label and branch target stays on a 4-byte boundary, where the verifier can still follow it (see verify.c).
+The VM runs 16-bit instructions anywhere, paired or not.
+*/
+
+// writes the 16-bit encoding of a 32-bit instruction to code, if it has one
+int compressIns(const uint8_t* ins, char* code) {
+    uint8_t op = ins[0], a1 = ins[1], a2 = ins[2], a3 = ins[3];
+    int form;
+    uint8_t b;
+    if (op == LIM && (int16_t)(a2 | a3 << 8) == (int8_t)a2 && a1 < 16) {
+        form = C_LIM;
+        b = a2;
+    } else if ((op == OR || op == AND) && a2 == a3 && a1 < 16 && a2 < 16) {
+        form = C_MOV;
+        b = a2;
+    } else if (op >= AND && op <= SHIFTR && a1 == a2 && a1 < 16 && a3 < 16) {
+        form = C_ALU;
+        b = (op - AND) << 4 | a3;
+    } else if ((op == LD16 || op == SV16) && a2 == 0 && a1 < 16) {
+        form = op == LD16 ? C_LD16 : C_SV16;
+        b = a3;
+    } else if ((op == BEQ || op == BNE) && a2 == 15 && a1 < 16) {
+        form = op == BEQ ? C_BEQ : C_BNE;
+        b = a3;
+    } else if (op == LJAL && a3 == 0 && a1 < 16 && a2 < 16) {
+        form = C_JAL;
+        b = a2;
+    } else {
+        return BAD;
+    }
+    code[0] = COMPRESSED | form << 4 | a1;
+    code[1] = b;
+    return OK;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#define COMPRESSED 0x80     // high bit of the first byte of a 16-bit instruction
+#define C_INVALID 0x7f      // what a reserved 16-bit encoding expands to, which runs as nothing and is never verified
+
+// 16-bit forms, in bits 4-6 of the first byte, see compress.c
+enum CFORM {
+    C_LIM,      // lim a b          b sign-extended
+    C_MOV,      // eth a b b
+    C_ALU,      // op a a b         op from AND to SHIFTR, in the high bits of b
+    C_LD16,     // l16 a r0 b
+    C_SV16,     // s16 a r0 b
+    C_BEQ,      // beq a r15 b
+    C_BNE,      // bne a r15 b
+    C_JAL,      // jal a b d0
+};
+
+// expands the 16-bit instruction at code into the 4 bytes of the instruction it stands for,
+// named by whichever of the VM's or the assembler's opcodes are in scope
+#define EXPAND(code, ins) { \
+    uint8_t ca = (uint8_t)(code)[0] & 15; \
+    uint8_t cb = (uint8_t)(code)[1]; \
+    switch (((uint8_t)(code)[0] >> 4) & 7) \
+    { \
+    case C_LIM: ins[0] = LIM; ins[1] = ca; ins[2] = cb; ins[3] = cb & 0x80 ? 0xff : 0; break; \
+    case C_MOV: ins[0] = cb < 16 ? OR : C_INVALID; ins[1] = ca; ins[2] = cb; ins[3] = cb; break; \
+    case C_ALU: ins[0] = cb < 128 ? AND + (cb >> 4) : C_INVALID; ins[1] = ca; ins[2] = ca; ins[3] = cb & 15; break; \
+    case C_LD16: ins[0] = LD16; ins[1] = ca; ins[2] = 0; ins[3] = cb; break; \
+    case C_SV16: ins[0] = SV16; ins[1] = ca; ins[2] = 0; ins[3] = cb; break; \
+    case C_BEQ: ins[0] = BEQ; ins[1] = ca; ins[2] = 15; ins[3] = cb; break; \
+    case C_BNE: ins[0] = BNE; ins[1] = ca; ins[2] = 15; ins[3] = cb; break; \
+    default: ins[0] = cb < 16 ? LJAL : C_INVALID; ins[1] = ca; ins[2] = cb; ins[3] = 0; break; \
+    } \
+}
+
+int compressIns(const uint8_t* ins, char* code);
@@ -0,0 +1,150 @@
+/* VM SUPERINSTRUCTIONS */
+#include "fuse.h"
+#include "verify.h"
+#include <stdlib.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+SUPERINSTRUCTIONS
+Common sequences of instructions, listed in fused.h, are run as one 'superinstruction' with a handler of its own,
+which saves dispatching each instruction in it separately.
+Once an image has been verified, it is predecoded: every verified slot starting a sequence in the list
+(the longest, if several do) gets the opcode of its superinstruction in vm->fused.
+Cpus run a superinstruction in place of the instruction in memory, but only in verified code.
+
+A superinstruction behaves exactly like its instructions run one by one: each one counts as retired,
+memory is written and devices are checked after each store, and before moving on to the next instruction,
+it is checked to be verified code, as when a cpu enters a verified block.
+An interrupt, or the next instruction failing that check, stops the superinstruction, and the rest is run one by one.
+Only interrupts raised by other cpus wait until the whole superinstruction has run, as they are never timed exactly anyway.
+Storing over an instruction unfuses every superinstruction it is part of.
+
+With -p file, the VM instead counts how often each pair and triple of opcodes is run in a row, adding them to the file.
+mfuse turns such profiles back into fused.h, picking the sequences which would save the most dispatches.
+*/
+
+int patterns[][FUSED_LEN] = {
+#define FUSE2(id, a, b) {a, b, -1},
+#define FUSE3(id, a, b, c) {a, b, c},
+#include "fused.h"
+#undef FUSE2
+#undef FUSE3
+    {-1, -1, -1}
+};
+
+void predecode(VM* vm) {
+    uint8_t* vblock = vm->vblock;
+    char* mem = vm->mem;
+    int slots = vm->vend / 4;
+    memset(vm->fused, 0, sizeof(vm->fused));
+    for (int slot = 0; slot < slots; slot++) {
+        if (vblock[slot] == 0) continue;
+        int best = 0;
+        for (int p = 0; patterns[p][0] >= 0; p++) {
+            int len = 0;
+            while (len < FUSED_LEN && patterns[p][len] >= 0) {
+                int s = slot + len;
+                if (s >= slots || vblock[s] == 0 || (uint8_t)mem[s * 4] != patterns[p][len]) break;
+                if (len + 1 < FUSED_LEN && patterns[p][len + 1] >= 0 && !FUSABLE(patterns[p][len])) break;
+                len++;
+            }
+            if ((len == FUSED_LEN || patterns[p][len] < 0) && len > best) {
+                best = len;
+                vm->fused[slot] = FUSED + p;
+            }
+        }
+    }
+}
+
+// drops the superinstructions using any slot from first to last
+void unfuse(VM* vm, int first, int last) {
+    first = first < FUSED_LEN - 1 ? 0 : first - (FUSED_LEN - 1);
+    for (int slot = first; slot <= last; slot++) {
+        vm->fused[slot] = 0;
+    }
+}
+
+void profileStep(Profile* profile, uint16_t pc, uint8_t op) {
+    if (op >= NOPS) {
+        profile->run = 0;
+        return;
+    }
+    if (pc != (uint16_t)(profile->pc + 4)) {
+        profile->run = 0;
+    }
+    if (profile->run >= 1) {
+        profile->pairs[profile->prev[0]][op]++;
+    }
+    if (profile->run >= 2) {
+        profile->triples[profile->prev[1]][profile->prev[0]][op]++;
+    }
+    profile->prev[1] = profile->prev[0];
+    profile->prev[0] = op;
+    profile->pc = pc;
+    profile->run++;
+}
+
+// adds the counts of every cpu to those already in a profile
+int writeProfile(VM* vm, char* path) {
+    char* names[] = OP_NAMES;
+    Profile* total = calloc(1, sizeof(Profile));
+    for (int i = 0; i < vm->ncpus; i++) {
+        Profile* p = vm->cpus[i].profile;
+        for (int a = 0; a < NOPS; a++) {
+            for (int b = 0; b < NOPS; b++) {
+                total->pairs[a][b] += p->pairs[a][b];
+                for (int c = 0; c < NOPS; c++) {
+                    total->triples[a][b][c] += p->triples[a][b][c];
+                }
+            }
+        }
+    }
+
+    FILE* f = fopen(path, "r");
+    if (f != NULL) {
+        char line[128];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            char n[3][16];
+            unsigned long long count;
+            int ops[3];
+            int got = sscanf(line, "%llu %15s %15s %15s", &count, n[0], n[1], n[2]);
+            for (int k = 0; k < got - 1; k++) {
+                ops[k] = -1;
+                for (int o = 0; o < NOPS; o++) {
+                    if (strcmp(n[k], names[o]) == 0) ops[k] = o;
+                }
+            }
+            if (got == 3 && ops[0] >= 0 && ops[1] >= 0) {
+                total->pairs[ops[0]][ops[1]] += count;
+            } else if (got == 4 && ops[0] >= 0 && ops[1] >= 0 && ops[2] >= 0) {
+                total->triples[ops[0]][ops[1]][ops[2]] += count;
+            }
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        free(total);
+        return BAD;
+    }
+    for (int a = 0; a < NOPS; a++) {
+        for (int b = 0; b < NOPS; b++) {
+            if (total->pairs[a][b] != 0) {
+                fprintf(f, "%llu %s %s\n", (unsigned long long)total->pairs[a][b], names[a], names[b]);
+            }
+            for (int c = 0; c < NOPS; c++) {
+                if (total->triples[a][b][c] != 0) {
+                    fprintf(f, "%llu %s %s %s\n", (unsigned long long)total->triples[a][b][c], names[a], names[b], names[c]);
+                }
+            }
+        }
+    }
+    fclose(f);
+    free(total);
+    return OK;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "vm.h"
+
+#define FUSED 128       // opcodes of superinstructions, which are only ever run, never stored in memory
+#define FUSED_LEN 3     // most instructions in a superinstruction
+
+// instructions which can be followed by another in a superinstruction
+#define WRITES_MEMORY(op) ((op) == SV8 || (op) == SV16 || (op) == SV32 || (op) == CAS || (op) == FADD)
+#define FUSABLE(op) (((op) >= LIM && (op) <= SHIFTR) || WRITES_MEMORY(op))
+
+#define NOPS (IPI + 1)
+#define OP_NAMES { \
+    "HLT", "LIM", "LD8", "LD16", "LD32", "SV8", "SV16", "SV32", \
+    "AND", "OR", "XOR", "NOR", "ADD", "ADDC", "SHIFTL", "SHIFTR", \
+    "LJAL", "BEQ", "BNE", "BLT", "BGT", "INT", "CAS", "FADD", "IPI", \
+}
+
+typedef struct Profile {
+    uint16_t pc;        // last instruction run
+    uint8_t prev[2];    // the last two opcodes run
+    int run;            // how many instructions in a row have been run up to here
+    uint64_t pairs[NOPS][NOPS];
+    uint64_t triples[NOPS][NOPS][NOPS];
+} Profile;
+
+void predecode(VM* vm);
+void unfuse(VM* vm, int first, int last);
+void profileStep(Profile* profile, uint16_t pc, uint8_t op);
+int writeProfile(VM* vm, char* path);
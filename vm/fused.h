@@ -0,0 +1,17 @@
+// superinstructions run by the VM, see fuse.c. generated by mfuse from profiles of programs/
+FUSE2(0, LIM, LIM)     // run 43 times
+FUSE3(1, LIM, LIM, LIM)     // run 15 times
+FUSE3(2, LIM, SV8, SV8)     // run 15 times
+FUSE2(3, SV8, SV8)     // run 28 times
+FUSE3(4, SV8, SV8, LIM)     // run 14 times
+FUSE2(5, LIM, ADD)     // run 27 times
+FUSE3(6, LIM, LIM, SV8)     // run 13 times
+FUSE3(7, LIM, ADD, BNE)     // run 11 times
+FUSE3(8, SV8, LIM, ADD)     // run 11 times
+FUSE3(9, LIM, ADD, ADD)     // run 10 times
+FUSE3(10, LD8, SV8, SV8)     // run 10 times
+FUSE3(11, ADD, LIM, ADD)     // run 10 times
+FUSE3(12, ADD, ADD, LIM)     // run 10 times
+FUSE2(13, LIM, SV8)     // run 19 times
+FUSE2(14, SV8, LIM)     // run 17 times
+FUSE2(15, ADD, BNE)     // run 13 times
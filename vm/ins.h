@@ -0,0 +1,383 @@
+#pragma once
+
+#include "vm.h"
+#include "verify.h"
+#include "snap.h"
+
+// uses the control block of the cpu being run, at ctl
+#define INT(code, offset) \
+*(uint16_t*)(mem + ctl + CTL_INT_RET) = pc + offset; \
+mem[ctl + CTL_INT_PRC] = mem[ctl]; \
+mem[ctl + CTL_INT_REQ] = code; \
+cpu->ints++; \
+cpu->intsBy[(code) & 31]++; \
+mem[ctl] = 0; \
+pc = *(uint16_t*)(mem + ctl + CTL_INT_HAND); \
+SWITCHED
+
+#define MEMEXCEPT cpu->memexcs++; left = 0; INT(0, 4)
+
+// accesses of len bytes at addr, which wrap around the top of memory, see vm.c
+#define LOAD(addr, len, type) ((addr) <= 65536 - (len) ? *(type*)(mem + (addr)) : (type)loadWrapped(mem, addr, len))
+#define STORE(addr, len, type, value) do { \
+    if ((addr) <= 65536 - (len)) *(type*)(mem + (addr)) = (value); \
+    else storeWrapped(vm, addr, len, value); \
+} while (0)
+
+/*
+PROCESS HOOKS
+The DO_ macros find the running process, and check and relocate its accesses, through these.
+By default they look everything up in memory on every access, as translated blocks do (see aot.c);
+each variant of run() redefines them, see run.h.
+*/
+#define CURRENT_PRC mem[ctl]
+#define RELOCATE(unaddr) (uint16_t)(OFFSET(prc) + (unaddr))
+#define READABLE(addr) isReadable(vm, addr, prc)
+#define WRITEABLE(unaddr, addr, len) isWriteable(vm, unaddr, addr, len, prc)
+#define STORED(addr, len)       // after every store, with its address and length
+#define SWITCHED                // after the process has changed
+#define TRACE(...)
+
+void gatherPerf(VM* vm);
+
+/*
+INSTRUCTIONS
+Each instruction is run by a DO_ macro, given its operand bytes and using the pc, registers and memory of run(),
+so that superinstructions (see fuse.c), translated blocks (see aot.c) and 16-bit instructions (see compress.c)
+all run the same code as the instructions they stand for.
+*/
+
+#define DO_LIM(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint16_t val = (uint16_t)((uint8_t)(a2) | (uint8_t)(a3) << 8); \
+    reg16[reg] = val; \
+}
+
+#define DO_LD8(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t addr = RELOCATE(offset + reg16[addrreg]); \
+    if (READABLE(addr)) { \
+        if (IN_PERF(addr, 1)) { \
+            gatherPerf(vm); \
+        } \
+        TRACE("loaded addr %i into 8r%i\n", addr, reg); \
+        reg8[reg] = mem[addr]; \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_LD16(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t addr = RELOCATE(offset + reg16[addrreg]); \
+    if (READABLE(addr)) { \
+        if (IN_PERF(addr, 2)) { \
+            gatherPerf(vm); \
+        } \
+        TRACE("loaded addr %i into 16r%i\n", addr, reg); \
+        reg16[reg] = LOAD(addr, 2, uint16_t); \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_LD32(a1, a2, a3) { \
+    uint8_t reg = (a2); \
+    uint8_t addrreg = (a1); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t addr = RELOCATE(offset + reg16[addrreg]); \
+    if (READABLE(addr)) { \
+        if (IN_PERF(addr, 4)) { \
+            gatherPerf(vm); \
+        } \
+        TRACE("loaded addr %i into 16r%i\n", addr, reg); \
+        reg32[reg] = LOAD(addr, 4, uint32_t); \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_SV8(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t unaddr = offset + reg16[addrreg]; \
+    uint16_t addr = RELOCATE(unaddr); \
+    if (WRITEABLE(unaddr, addr, 1)) { \
+        TRACE("wrote: 8x%i to: %i\n", reg8[reg], addr); \
+        mem[addr] = reg8[reg]; \
+        if (addr < vm->vend) { \
+            unverify(vm, addr, 1); \
+        } \
+        DIRTY(vm, addr, 1); \
+        STORED(addr, 1) \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_SV16(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t unaddr = offset + reg16[addrreg]; \
+    uint16_t addr = RELOCATE(unaddr); \
+    if (WRITEABLE(unaddr, addr, 2)) { \
+        TRACE("wrote: 16x%i to: %i\n", reg16[reg], addr); \
+        STORE(addr, 2, uint16_t, reg16[reg]); \
+        if (addr < vm->vend) { \
+            unverify(vm, addr, 2); \
+        } \
+        DIRTY(vm, addr, 2); \
+        STORED(addr, 2) \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_SV32(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t unaddr = offset + reg16[addrreg]; \
+    uint16_t addr = RELOCATE(unaddr); \
+    if (WRITEABLE(unaddr, addr, 4)) { \
+        TRACE("wrote: 32x%i to: %i\n", reg32[reg], addr); \
+        STORE(addr, 4, uint32_t, reg32[reg]); \
+        if (addr < vm->vend) { \
+            unverify(vm, addr, 4); \
+        } \
+        DIRTY(vm, addr, 4); \
+        STORED(addr, 4) \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_AND(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i & r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] & reg16[srcreg2]; \
+}
+
+#define DO_OR(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i | r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] | reg16[srcreg2]; \
+}
+
+#define DO_XOR(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i ^ r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] ^ reg16[srcreg2]; \
+}
+
+#define DO_NOR(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("~(r%i | r%i) -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = ~(reg16[srcreg1] | reg16[srcreg2]); \
+}
+
+#define DO_ADD(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i + r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] + reg16[srcreg2]; \
+}
+
+#define DO_ADDC(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i + r%i + 1 -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] + reg16[srcreg2] + 1; \
+}
+
+#define DO_SHIFTL(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i << r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] << reg16[srcreg2]; \
+}
+
+#define DO_SHIFTR(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg1 = (a2); \
+    uint8_t srcreg2 = (a3); \
+    TRACE("r%i >> r%i -> r%i\n", srcreg1, srcreg2, destreg); \
+    reg16[destreg] = reg16[srcreg1] >> reg16[srcreg2]; \
+}
+
+#define DO_LJAL(a1, a2, a3) { \
+    uint8_t destreg = (a1); \
+    uint8_t srcreg = (a2); \
+    int8_t offset = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t newpos = reg16[srcreg] - 4; \
+    reg16[destreg] = pc + offset + 4; \
+    if (READABLE(newpos)) { \
+        TRACE("LJAL from %i to %i\n", reg16[destreg], newpos + 4); \
+        pc = newpos; \
+        cpu->branches++; \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_BEQ(a1, a2, a3) { \
+    uint8_t srcreg1 = (a1); \
+    uint8_t srcreg2 = (a2); \
+    int8_t offset = (a3); \
+    if (reg16[srcreg1] == reg16[srcreg2]) { \
+        uint8_t prc = CURRENT_PRC; (void)prc; \
+        uint16_t newpos = pc + offset; \
+        if ((trusted && (vblock[pc / 4] & VERIFIED_TARGET)) || READABLE(newpos)) { \
+            TRACE("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos); \
+            pc = newpos; \
+            cpu->branches++; \
+        } else { \
+            MEMEXCEPT \
+        } \
+    } \
+}
+
+#define DO_BNE(a1, a2, a3) { \
+    uint8_t srcreg1 = (a1); \
+    uint8_t srcreg2 = (a2); \
+    int8_t offset = (a3); \
+    if (reg16[srcreg1] != reg16[srcreg2]) { \
+        uint8_t prc = CURRENT_PRC; (void)prc; \
+        uint16_t newpos = pc + offset; \
+        if ((trusted && (vblock[pc / 4] & VERIFIED_TARGET)) || READABLE(newpos)) { \
+            TRACE("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos); \
+            pc = newpos; \
+            cpu->branches++; \
+        } else { \
+            MEMEXCEPT \
+        } \
+    } \
+}
+
+#define DO_BLT(a1, a2, a3) { \
+    uint8_t srcreg1 = (a1); \
+    uint8_t srcreg2 = (a2); \
+    int8_t offset = (a3); \
+    if (reg16[srcreg1] < reg16[srcreg2]) { \
+        uint8_t prc = CURRENT_PRC; (void)prc; \
+        uint16_t newpos = pc + offset; \
+        if ((trusted && (vblock[pc / 4] & VERIFIED_TARGET)) || READABLE(newpos)) { \
+            TRACE("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos); \
+            pc = newpos; \
+            cpu->branches++; \
+        } else { \
+            MEMEXCEPT \
+        } \
+    } \
+}
+
+#define DO_BGT(a1, a2, a3) { \
+    uint8_t srcreg1 = (a1); \
+    uint8_t srcreg2 = (a2); \
+    int8_t offset = (a3); \
+    if (reg16[srcreg1] > reg16[srcreg2]) { \
+        uint8_t prc = CURRENT_PRC; (void)prc; \
+        uint16_t newpos = pc + offset; \
+        if ((trusted && (vblock[pc / 4] & VERIFIED_TARGET)) || READABLE(newpos)) { \
+            TRACE("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos); \
+            pc = newpos; \
+            cpu->branches++; \
+        } else { \
+            MEMEXCEPT \
+        } \
+    } \
+}
+
+#define DO_INT(a1, a2, a3) { \
+    uint8_t code = (a1); \
+    int8_t offset = (a2); \
+\
+    TRACE("interrupt; c:%i, o:%i\n", code, offset); \
+\
+    INT(code, offset) \
+}
+
+#define DO_CAS(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    uint8_t srcreg = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t unaddr = reg16[addrreg]; \
+    uint16_t addr = RELOCATE(unaddr); \
+    if (addr % 2 == 0 && WRITEABLE(unaddr, addr, 2)) { \
+        TRACE("cas %i: %i -> %i\n", addr, reg16[reg], reg16[srcreg]); \
+        __atomic_compare_exchange_n((uint16_t*)(mem + addr), reg16 + reg, reg16[srcreg], 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        if (addr < vm->vend) { \
+            unverify(vm, addr, 2); \
+        } \
+        DIRTY(vm, addr, 2); \
+        STORED(addr, 2) \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_FADD(a1, a2, a3) { \
+    uint8_t reg = (a1); \
+    uint8_t addrreg = (a2); \
+    uint8_t srcreg = (a3); \
+\
+    uint8_t prc = CURRENT_PRC; (void)prc; \
+    uint16_t unaddr = reg16[addrreg]; \
+    uint16_t addr = RELOCATE(unaddr); \
+    if (addr % 2 == 0 && WRITEABLE(unaddr, addr, 2)) { \
+        TRACE("fadd %i += %i\n", addr, reg16[srcreg]); \
+        reg16[reg] = __atomic_fetch_add((uint16_t*)(mem + addr), reg16[srcreg], __ATOMIC_SEQ_CST); \
+        if (addr < vm->vend) { \
+            unverify(vm, addr, 2); \
+        } \
+        DIRTY(vm, addr, 2); \
+        STORED(addr, 2) \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
+
+#define DO_IPI(a1, a2, a3) { \
+    uint8_t target = (a1); \
+    uint8_t code = (a2); \
+\
+    if (CURRENT_PRC == 0 && target < vm->ncpus && code < STOP_INT) { \
+        TRACE("ipi; cpu:%i, c:%i\n", target, code); \
+        raiseInt(vm, target, code); \
+    } else { \
+        MEMEXCEPT \
+    } \
+}
@@ -0,0 +1,313 @@
+/* TOOLCHAIN INTERMEDIATE REPRESENTATION */
+#include "ir.h"
+
+/*
+INTERMEDIATE REPRESENTATION
+The preprocessor hands the assembler a program as a list of items rather than as text:
+instructions with their operands already parsed, string data already unescaped, and labels.
+Operands naming a label point straight at its symbol, and are resolved by the assembler once it knows
+where the label ends up, so label addresses are exact however long the items before them are.
+*/
+
+Item* addItem(Program* prog, int kind, int line) {
+    if (prog->count == prog->cap) {
+        int cap = prog->cap == 0 ? 256 : prog->cap * 2;
+        Item* items = arenaAlloc(prog->arena, cap * sizeof(Item));
+        if (prog->count) memcpy(items, prog->items, prog->count * sizeof(Item));
+        prog->items = items;
+        prog->cap = cap;
+    }
+    Item* item = &prog->items[prog->count++];
+    memset(item, 0, sizeof(Item));
+    item->kind = kind;
+    item->line = line;
+    return item;
+}
+
+/*
+DATA LAYOUT
+Besides string data, '.byte', '.half' and '.word' lay out 1, 2 and 4-byte little-endian values,
+which may use labels like any operand. '.zero N' reserves N zero bytes, and '.align N' pads with zeros up to
+the next multiple of N, so how long it is depends on where it is.
+Reserved bytes are only written out once something follows them: those at the end of the program take up
+no room in the image, since the VM's memory starts zeroed.
+*/
+
+// how many bytes an item takes up, at position p
+int itemSize(Item* item, int p) {
+    switch (item->kind) {
+    case ITEM_INS: return item->half ? 2 : 4;
+    case ITEM_DATA: return item->len;
+    case ITEM_VALUE: return item->op;
+    case ITEM_ZERO: return item->len;
+    case ITEM_ALIGN: return -p & (item->len - 1);
+    default: return 0;
+    }
+}
+
+// whether an item only reserves zeros, rather than putting anything in the image
+int isReserved(Item* item) {
+    return item->kind == ITEM_ZERO || item->kind == ITEM_ALIGN;
+}
+
+/*
+CONSTANT EXPRESSIONS
+Operands may be expressions over numbers, labels and constants ('#!const NAME expr'),
+using + - << >> and hi() and lo(), which take the high and low byte of a 16-bit value.
+Expressions which do not depend on labels are folded as soon as they are read;
+the rest are evaluated by the assembler once the labels they use have been placed.
+*/
+
+#define CONST_DEPTH 64
+
+// evaluates an expression. unless final, a label which has not been placed yet makes it pending rather than bad
+int evalExpr(Expr* x, int* value, int final, int line, int depth) {
+    int a = 0;
+    int b = 0;
+    int st;
+    switch (x->kind) {
+    case EXPR_NUM:
+        *value = x->num;
+        return EVAL_OK;
+
+    case EXPR_LABEL:
+        if (x->sym->pos < 0) {
+            if (!final) return EVAL_PENDING;
+            toolPrintf("FATAL: LABEL \"%s\" NOT FOUND, ON LINE %i.\n", x->sym->name, line);
+            return EVAL_BAD;
+        }
+        *value = x->sym->pos;
+        return EVAL_OK;
+
+    case EXPR_CONST:
+        if (x->sym->value == NULL) {
+            toolPrintf("FATAL: CONSTANT \"%s\" NOT DEFINED, ON LINE %i.\n", x->sym->name, line);
+            return EVAL_BAD;
+        }
+        if (depth == CONST_DEPTH) {
+            toolPrintf("FATAL: CONSTANT \"%s\" DEFINED IN TERMS OF ITSELF, ON LINE %i.\n", x->sym->name, line);
+            return EVAL_BAD;
+        }
+        return evalExpr(x->sym->value, value, final, line, depth + 1);
+
+    default:
+        break;
+    }
+
+    st = evalExpr(x->a, &a, final, line, depth);
+    if (st != EVAL_OK) return st;
+    if (x->b != NULL) {
+        st = evalExpr(x->b, &b, final, line, depth);
+        if (st != EVAL_OK) return st;
+    }
+    switch (x->kind) {
+    case EXPR_NEG: *value = -a; break;
+    case EXPR_ADD: *value = a + b; break;
+    case EXPR_SUB: *value = a - b; break;
+    case EXPR_SHL: *value = a << b; break;
+    case EXPR_SHR: *value = a >> b; break;
+    case EXPR_HI: *value = (a >> 8) & 0xff; break;
+    case EXPR_LO: *value = a & 0xff; break;
+    }
+    return EVAL_OK;
+}
+
+int getInsType(int op) {
+    switch (op) {
+    case LIM:
+        return REG_IMM16;
+    case LD8: case LD16: case LD32:
+    case SV8: case SV16: case SV32:
+    case LJAL: case BEQ: case BNE: case BLT: case BGT:
+        return REG2_IMM8;
+    case AND: case OR: case XOR: case NOR:
+    case ADD: case ADDC: case SHIFTL: case SHIFTR:
+    case CAS: case FADD:
+        return REG3;
+    case INT: case IPI:
+        return IMM8x2;
+    default:
+        return UNARY;
+    }
+}
+
+// whether an operand may be used where an immediate is expected
+#define IS_IMM(item, o) ((item)->opkind[o] != OPND_REG)
+#define IS_REG(item, o) ((item)->opkind[o] == OPND_REG)
+
+int checkOperands(Item* item) {
+    switch (getInsType(item->op))
+    {
+    case UNARY:
+        return item->nops == 0;
+    case REG_IMM16:
+        return item->nops == 2 && IS_REG(item, 0) && IS_IMM(item, 1);
+    case REG2_IMM8:
+        return item->nops == 3 && IS_REG(item, 0) && IS_REG(item, 1) && IS_IMM(item, 2);
+    case REG3:
+        return item->nops == 3 && IS_REG(item, 0) && IS_REG(item, 1) && IS_REG(item, 2);
+    case IMM8x2:
+        return item->nops == 2 && IS_IMM(item, 0) && IS_IMM(item, 1);
+    default:
+        toolPrintf("Something has gone seriously wrong...\n");
+        return 0;
+    }
+}
+
+// the first register operand naming a register beyond those of its width, or -1:
+// 32 8-bit registers, 16 16-bit registers or 8 32-bit registers, which overlap, see vm.h
+int badRegister(Item* item, int* count) {
+    for (int o = 0; o < item->nops; o++) {
+        if (!IS_REG(item, o)) continue;
+        switch (item->op) {
+        case LD8: case SV8: *count = o == 0 ? 32 : 16; break;
+        case LD32: *count = o == 1 ? 8 : 16; break;
+        case SV32: *count = o == 0 ? 8 : 16; break;
+        default: *count = 16; break;
+        }
+        if (item->ops[o].imm >= *count) return o;
+    }
+    return -1;
+}
+
+// whether a value fits a field of size bytes, taken as either signed or unsigned
+int fitsField(int value, int size) {
+    return size >= 4 || (value >= -(1 << (8*size - 1)) && value < (1 << 8*size));
+}
+
+// which operand of an item is a numeric offset from it, and what the offset is relative to
+int offsetOperand(Item* item, int* base) {
+    if (item->kind != ITEM_INS || !checkOperands(item)) return -1;
+    int o;
+    switch (item->op) {
+    case LJAL: case BEQ: case BNE: case BLT: case BGT:
+        o = 2;
+        *base = item->half ? 2 : 4;
+        break;
+    case INT:
+        o = 1;
+        *base = 0;
+        break;
+    default:
+        return -1;
+    }
+    return item->opkind[o] == OPND_IMM ? o : -1;
+}
+
+char* mnemonics[] = {
+    "hlt", "lim", "l08", "l16", "l32", "s08", "s16", "s32",
+    "and", "eth", "xor", "nor", "add", "adc", "shl", "shr",
+    "jal", "beq", "bne", "blt", "bgt", "int", "cas", "fad", "ipi",
+};
+
+void printExpr(Expr* x, Buf* out) {
+    char num[16];
+    switch (x->kind) {
+    case EXPR_NUM:
+        bufPut(out, num, sprintf(num, "d%i", x->num));
+        return;
+    case EXPR_LABEL:
+        bufPutc(out, '.');
+        bufPut(out, x->sym->name, x->sym->len);
+        return;
+    case EXPR_CONST:
+        // constants are not part of the program, so are printed out in full
+        bufPutc(out, '(');
+        printExpr(x->sym->value, out);
+        bufPutc(out, ')');
+        return;
+    case EXPR_NEG:
+        bufPutc(out, '-');
+        printExpr(x->a, out);
+        return;
+    case EXPR_HI:
+    case EXPR_LO:
+        bufPut(out, x->kind == EXPR_HI ? "hi(" : "lo(", 3);
+        printExpr(x->a, out);
+        bufPutc(out, ')');
+        return;
+    }
+    bufPutc(out, '(');
+    printExpr(x->a, out);
+    switch (x->kind) {
+    case EXPR_ADD: bufPutc(out, '+'); break;
+    case EXPR_SUB: bufPutc(out, '-'); break;
+    case EXPR_SHL: bufPut(out, "<<", 2); break;
+    case EXPR_SHR: bufPut(out, ">>", 2); break;
+    }
+    printExpr(x->b, out);
+    bufPutc(out, ')');
+}
+
+// prints a program back out as source, which assembles to the same image
+void printOperand(Item* item, int o, Buf* out) {
+    char num[16];
+    switch (item->opkind[o]) {
+    case OPND_REG:
+        bufPut(out, num, sprintf(num, "r%i", item->ops[o].imm));
+        break;
+    case OPND_IMM:
+        bufPut(out, num, sprintf(num, "d%i", item->ops[o].imm));
+        break;
+    case OPND_SYM:
+        bufPutc(out, '.');
+        bufPut(out, item->ops[o].sym->name, item->ops[o].sym->len);
+        break;
+    case OPND_EXPR:
+        printExpr(item->ops[o].expr, out);
+        break;
+    }
+}
+
+void dumpProgram(Program* prog, Buf* out) {
+    char num[16];
+    for (int i = 0; i < prog->count; i++) {
+        Item* item = &prog->items[i];
+        switch (item->kind) {
+        case ITEM_LABEL:
+            bufPutc(out, '.');
+            bufPut(out, item->label->name, item->label->len);
+            break;
+
+        case ITEM_DATA:
+            bufPutc(out, '"');
+            for (int c = 0; c < item->len; c++) {
+                char d = item->data[c];
+                if (d == 0) {
+                    bufPut(out, "\\0", 2);
+                } else if (d == '\n') {
+                    bufPut(out, "\\n", 2);
+                } else if (d == '"' || d == '\\') {
+                    bufPutc(out, '\\');
+                    bufPutc(out, d);
+                } else {
+                    bufPutc(out, d);
+                }
+            }
+            bufPutc(out, '"');
+            break;
+
+        case ITEM_INS:
+            bufPut(out, item->op == NOP ? "nop" : mnemonics[item->op], 3);
+            for (int o = 0; o < item->nops; o++) {
+                bufPutc(out, ' ');
+                printOperand(item, o, out);
+            }
+            break;
+
+        case ITEM_VALUE:
+            bufPut(out, item->op == 1 ? ".byte " : item->op == 2 ? ".half " : ".word ", 6);
+            printOperand(item, 0, out);
+            break;
+
+        case ITEM_ZERO:
+            bufPut(out, num, sprintf(num, ".zero d%i", item->len));
+            break;
+
+        case ITEM_ALIGN:
+            bufPut(out, num, sprintf(num, ".align d%i", item->len));
+            break;
+        }
+        bufPutc(out, '\n');
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include "sym.h"
+#include "buf.h"
+
+enum INS_TKN {
+    HLT,
+
+    LIM,
+
+    LD8,
+    LD16,
+    LD32,
+
+    SV8,
+    SV16,
+    SV32,
+
+    AND,
+    OR,
+    XOR,
+    NOR,
+
+    ADD,
+    ADDC,
+    SHIFTL,
+    SHIFTR,
+
+    LJAL,
+    BEQ,
+    BNE,
+    BLT,
+    BGT,
+    INT,
+
+    CAS,
+    FADD,
+    IPI,
+};
+
+#define NOP 64
+
+enum INS_TYPE {
+    UNARY,
+    REG_IMM16,
+    REG2_IMM8,
+    REG3,
+    IMM8x2,
+};
+
+enum ITEM_KIND {
+    ITEM_INS,
+    ITEM_DATA,
+    ITEM_LABEL,
+    ITEM_VALUE,     // .byte, .half or .word
+    ITEM_ZERO,      // .zero
+    ITEM_ALIGN,     // .align
+};
+
+enum OPND_KIND {
+    OPND_REG,
+    OPND_IMM,
+    OPND_SYM,
+    OPND_EXPR,
+};
+
+enum EXPR_KIND {
+    EXPR_NUM,
+    EXPR_LABEL,
+    EXPR_CONST,
+    EXPR_NEG,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_SHL,
+    EXPR_SHR,
+    EXPR_HI,
+    EXPR_LO,
+};
+
+typedef struct Expr {
+    uint8_t kind;
+    int num;            // EXPR_NUM
+    Sym* sym;           // EXPR_LABEL, EXPR_CONST
+    struct Expr* a;     // operands
+    struct Expr* b;
+} Expr;
+
+enum EVAL {
+    EVAL_OK,
+    EVAL_PENDING,       // depends on a label that has not been placed yet
+    EVAL_BAD,
+};
+
+typedef union {
+    int imm;        // register number or immediate
+    Sym* sym;       // label
+    Expr* expr;     // expression which could not be folded before labels were placed
+} Operand;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t op;     // instruction, or size in bytes of an ITEM_VALUE
+    uint8_t nops;
+    uint8_t opkind[3];
+    uint8_t half;   // ITEM_INS encoded in 16 bits, see compress.c
+    int line;       // source line, for errors
+    union {
+        Operand ops[3];     // ITEM_INS, and ops[0] of ITEM_VALUE
+        struct {            // ITEM_DATA, and the len of ITEM_ZERO and ITEM_ALIGN
+            char* data;
+            int len;
+        };
+        Sym* label;         // ITEM_LABEL
+    };
+} Item;
+
+typedef struct {
+    Arena* arena;   // owns the items
+    Item* items;
+    int count;
+    int cap;
+} Program;
+
+Item* addItem(Program* prog, int kind, int line);
+int itemSize(Item* item, int p);
+int isReserved(Item* item);
+int getInsType(int op);
+int checkOperands(Item* item);
+int badRegister(Item* item, int* count);
+int fitsField(int value, int size);
+int offsetOperand(Item* item, int* base);
+int evalExpr(Expr* x, int* value, int final, int line, int depth);
+void dumpProgram(Program* prog, Buf* out);
@@ -0,0 +1,442 @@
+/* TOOLCHAIN TOKENIZER */
+#include "lex.h"
+
+enum {
+    OK,
+    BAD,
+};
+
+/*
+TOKENIZER
+Source is never copied: lines and tokens are scanned in place as (start, end) ranges of the input,
+so there is no limit on the length of a line. Mnemonics are three characters, which are packed into an integer
+and looked up with a single switch. Each line becomes one item of the program, see ir.c.
+*/
+
+#define MNEM(a, b, c) ((a) | (b) << 8 | (c) << 16)
+
+int classifyIns(char* s, char* e, int* err) {
+    *err = OK;
+    if (e - s != 3) {
+        *err = BAD;
+        return 0;
+    }
+    switch (MNEM(s[0], s[1], s[2])) {
+    case MNEM('h', 'l', 't'): return HLT;
+    case MNEM('l', 'i', 'm'): return LIM;
+    case MNEM('l', '0', '8'): return LD8;
+    case MNEM('l', '1', '6'): return LD16;
+    case MNEM('l', '3', '2'): return LD32;
+    case MNEM('s', '0', '8'): return SV8;
+    case MNEM('s', '1', '6'): return SV16;
+    case MNEM('s', '3', '2'): return SV32;
+
+    case MNEM('a', 'n', 'd'): return AND;
+    case MNEM('e', 't', 'h'): return OR;
+    case MNEM('x', 'o', 'r'): return XOR;
+    case MNEM('n', 'o', 'r'): return NOR;
+
+    case MNEM('a', 'd', 'd'): return ADD;
+    case MNEM('a', 'd', 'c'): return ADDC;
+    case MNEM('s', 'h', 'l'): return SHIFTL;
+    case MNEM('s', 'h', 'r'): return SHIFTR;
+
+    case MNEM('j', 'a', 'l'): return LJAL;
+    case MNEM('b', 'e', 'q'): return BEQ;
+    case MNEM('b', 'n', 'e'): return BNE;
+    case MNEM('b', 'l', 't'): return BLT;
+    case MNEM('b', 'g', 't'): return BGT;
+    case MNEM('i', 'n', 't'): return INT;
+
+    case MNEM('c', 'a', 's'): return CAS;
+    case MNEM('f', 'a', 'd'): return FADD;
+    case MNEM('i', 'p', 'i'): return IPI;
+    case MNEM('n', 'o', 'p'): return NOP;
+    }
+    *err = BAD;
+    return 0;
+}
+
+int stoi(char* s, char* e, int* err) {
+    *err = OK;
+    int acc = 0;
+    int neg_flag = 0;
+    if (s < e && s[0] == '-') {
+        neg_flag = 1;
+        s++;
+    }
+    if (s == e) {
+        *err = BAD;
+        return 0;
+    }
+    for (; s < e; s++) {
+        int d = *s - '0';
+        if (d < 0 || d > 9) {
+            *err = BAD;
+            return 0;
+        }
+        acc = acc * 10 + d;
+    }
+    if (neg_flag) {
+        return -acc;
+    } else {
+        return acc;
+    }
+}
+
+int btoi(char* s, char* e, int* err) {
+    *err = OK;
+    int acc = 0;
+    if (s == e) {
+        *err = BAD;
+        return 0;
+    }
+    for (; s < e; s++) {
+        int d = *s - '0';
+        if (d != 0 && d != 1) {
+            *err = BAD;
+            return 0;
+        }
+        acc = acc * 2 + d;
+    }
+    return acc;
+}
+
+int parseRegister(char* s, char* e, int* err) {
+    *err = OK;
+    if (s == e || s[0] != 'r') {
+        *err = BAD;
+        return 0;
+    }
+    int n = stoi(s + 1, e, err);
+    if (*err != OK) {
+        return 0;
+    }
+    if (n < 0 || n > 31) {
+        *err = BAD;
+        return 0;
+    }
+    return n;
+}
+
+// finds the next space-separated token of the line ending at end, leaving it in [*s, *e)
+void nextToken(char** s, char** e, char* end) {
+    char* p = *e;
+    while (p < end && isspace(*p)) p++;
+    *s = p;
+    while (p < end && !isspace(*p)) p++;
+    *e = p;
+}
+
+#define IS_IDENT(c) (isalnum(c) || (c) == '_' || (c) == '~')
+
+typedef struct {
+    char* p;        // next character
+    char* end;
+    Arena* arena;
+    SymTab* syms;
+    int* err;
+} Parser;
+
+Expr* newExpr(Parser* ps, int kind, Expr* a, Expr* b) {
+    Expr* x = arenaZalloc(ps->arena, sizeof(Expr));
+    x->kind = kind;
+    x->a = a;
+    x->b = b;
+    return x;
+}
+
+Expr* bad(Parser* ps) {
+    *ps->err = BAD;
+    return newExpr(ps, EXPR_NUM, NULL, NULL);
+}
+
+int peek(Parser* ps) {
+    while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t')) ps->p++;
+    return ps->p < ps->end ? *ps->p : 0;
+}
+
+Expr* parseShift(Parser* ps);
+
+Expr* parsePrimary(Parser* ps) {
+    int c = peek(ps);
+    char* s = ps->p;
+    Expr* x;
+    if (c == '(') {
+        ps->p++;
+        x = parseShift(ps);
+        if (peek(ps) != ')') return bad(ps);
+        ps->p++;
+        return x;
+    }
+    if (c == '\'') {
+        if (ps->end - s < 2) return bad(ps);
+        x = newExpr(ps, EXPR_NUM, NULL, NULL);
+        x->num = s[1];
+        ps->p += 2;
+        return x;
+    }
+    if (c == '.') {
+        ps->p++;
+        while (ps->p < ps->end && IS_IDENT(*ps->p)) ps->p++;
+        if (ps->p == s + 1) return bad(ps);
+        x = newExpr(ps, EXPR_LABEL, NULL, NULL);
+        x->sym = intern(ps->syms, s + 1, ps->p - s - 1);
+        return x;
+    }
+    // numbers are plain or d-prefixed decimal, or b-prefixed binary
+    char* digits = s;
+    if (c == 'd' && ps->end - s > 1 && (isdigit(s[1]) || s[1] == '-')) {
+        digits = s + 1;
+    } else if (c == 'b' && ps->end - s > 1 && (s[1] == '0' || s[1] == '1')) {
+        digits = s + 1;
+    }
+    if (isdigit(*digits) || digits != s) {
+        char* e = digits;
+        if (e < ps->end && *e == '-') e++;
+        while (e < ps->end && isdigit(*e)) e++;
+        x = newExpr(ps, EXPR_NUM, NULL, NULL);
+        x->num = c == 'b' ? btoi(digits, e, ps->err) : stoi(digits, e, ps->err);
+        ps->p = e;
+        return x;
+    }
+    if (IS_IDENT(c)) {
+        while (ps->p < ps->end && IS_IDENT(*ps->p)) ps->p++;
+        int len = ps->p - s;
+        if (len == 2 && (memcmp(s, "hi", 2) == 0 || memcmp(s, "lo", 2) == 0) && peek(ps) == '(') {
+            return newExpr(ps, s[0] == 'h' ? EXPR_HI : EXPR_LO, parsePrimary(ps), NULL);
+        }
+        x = newExpr(ps, EXPR_CONST, NULL, NULL);
+        x->sym = intern(ps->syms, s, len);
+        return x;
+    }
+    return bad(ps);
+}
+
+Expr* parseUnary(Parser* ps) {
+    if (peek(ps) == '-') {
+        ps->p++;
+        return newExpr(ps, EXPR_NEG, parseUnary(ps), NULL);
+    }
+    return parsePrimary(ps);
+}
+
+Expr* parseSum(Parser* ps) {
+    Expr* x = parseUnary(ps);
+    for (;;) {
+        int c = peek(ps);
+        if (c != '+' && c != '-') return x;
+        ps->p++;
+        x = newExpr(ps, c == '+' ? EXPR_ADD : EXPR_SUB, x, parseUnary(ps));
+    }
+}
+
+Expr* parseShift(Parser* ps) {
+    Expr* x = parseSum(ps);
+    for (;;) {
+        int c = peek(ps);
+        if ((c != '<' && c != '>') || ps->end - ps->p < 2 || ps->p[1] != c) return x;
+        ps->p += 2;
+        x = newExpr(ps, c == '<' ? EXPR_SHL : EXPR_SHR, x, parseSum(ps));
+    }
+}
+
+// parses an expression taking up all of [s, e)
+Expr* parseExpr(char* s, char* e, Arena* arena, SymTab* syms, int* err) {
+    *err = OK;
+    Parser ps = {s, e, arena, syms, err};
+    Expr* x = parseShift(&ps);
+    if (peek(&ps) != 0) *err = BAD;
+    return x;
+}
+
+int parseOperand(char* s, char* e, Program* prog, SymTab* syms, Item* item, int* err) {
+    *err = OK;
+    int o = item->nops;
+    if (o == 3) {
+        *err = BAD;
+        return 0;
+    }
+    item->nops++;
+    if (s[0] == 'r' && e - s > 1 && isdigit(s[1])) {
+        item->opkind[o] = OPND_REG;
+        item->ops[o].imm = parseRegister(s, e, err);
+        return *err;
+    }
+    Expr* x = parseExpr(s, e, prog->arena, syms, err);
+    if (*err != OK) return *err;
+    int value;
+    if (x->kind == EXPR_LABEL) {
+        item->opkind[o] = OPND_SYM;
+        item->ops[o].sym = x->sym;
+        return *err;
+    }
+    switch (evalExpr(x, &value, 0, item->line, 0)) {
+    case EVAL_OK:
+        item->opkind[o] = OPND_IMM;
+        item->ops[o].imm = value;
+        break;
+    case EVAL_PENDING:
+        item->opkind[o] = OPND_EXPR;
+        item->ops[o].expr = x;
+        break;
+    default:
+        *err = BAD;
+    }
+    return *err;
+}
+
+// unescapes a string literal into the arena, returning where it ended
+char* parseStrData(char* str, char* end, Program* prog, Item* item, int* err) {
+    *err = OK;
+    item->data = arenaAlloc(prog->arena, end - str);
+    item->len = 0;
+    for (char* i = str + 1; i < end; i++) {
+        if (*i == '"') {
+            return i + 1;
+        } else if (*i == '\\') {
+            i++;
+            if (i == end) break;
+            switch(*i) {
+            case '0':
+                item->data[item->len] = 0; break;
+            case 'n':
+                item->data[item->len] = '\n'; break;
+            default:
+                item->data[item->len] = *i; break;
+            }
+        } else {
+            item->data[item->len] = *i;
+        }
+        item->len++;
+    }
+    *err = BAD;
+    return end;
+}
+
+/*
+DIRECTIVES
+A line starting with a name, like a label, but with more after it is a directive:
+    .global name ...    exports labels from an object file, see obj.c
+    .byte value ...     lays out 8, 16 or 32-bit values, see ir.c
+    .half value ...
+    .word value ...
+    .zero N             reserves N zero bytes
+    .align N            pads to a multiple of N, which must be a power of two
+*/
+
+#define IS_DIRECTIVE(name, len, str) ((len) == sizeof(str) - 1 && memcmp(name, str, len) == 0)
+
+// parses the arguments of a directive, leaving [*s, *e) at the last token parsed
+void parseDirective(char* name, int len, char** s, char** e, char* end, Program* prog, SymTab* syms, int lineno, int* err) {
+    if (IS_DIRECTIVE(name, len, "global")) {
+        for (;;) {
+            nextToken(s, e, end);
+            if (*s == *e) return;
+            char* label = **s == '.' ? *s + 1 : *s;
+            if (label == *e) {
+                *err = BAD;
+                return;
+            }
+            intern(syms, label, *e - label)->global = 1;
+        }
+    }
+    int size = IS_DIRECTIVE(name, len, "byte") ? 1 : IS_DIRECTIVE(name, len, "half") ? 2 : IS_DIRECTIVE(name, len, "word") ? 4 : 0;
+    if (size != 0) {
+        for (;;) {
+            nextToken(s, e, end);
+            if (*s == *e) return;
+            Item* item = addItem(prog, ITEM_VALUE, lineno);
+            item->op = size;
+            if (parseOperand(*s, *e, prog, syms, item, err) != OK || item->opkind[0] == OPND_REG) {
+                *err = BAD;
+                return;
+            }
+        }
+    }
+    int zero = IS_DIRECTIVE(name, len, "zero");
+    if (zero || IS_DIRECTIVE(name, len, "align")) {
+        nextToken(s, e, end);
+        Expr* x = parseExpr(*s, *e, prog->arena, syms, err);
+        int n;
+        if (*err != OK || evalExpr(x, &n, 0, lineno, 0) != EVAL_OK || n < 0 || n > 65536) {
+            toolPrintf("FATAL: .%.*s TAKES A CONSTANT SIZE, ON LINE %i.\n", len, name, lineno);
+            *err = BAD;
+            return;
+        }
+        if (!zero && (n == 0 || (n & (n - 1)) != 0)) {
+            toolPrintf("FATAL: ALIGNMENT %i IS NOT A POWER OF TWO, ON LINE %i.\n", n, lineno);
+            *err = BAD;
+            return;
+        }
+        addItem(prog, zero ? ITEM_ZERO : ITEM_ALIGN, lineno)->len = n;
+        return;
+    }
+    toolPrintf("FATAL: UNKNOWN DIRECTIVE \".%.*s\", ON LINE %i.\n", len, name, lineno);
+    *err = BAD;
+}
+
+// turns NUL-terminated source, with its macros already expanded, into items.
+// lines gives the source line of each line of src, see pre.c, or is NULL if src is the source itself
+void tokenize(char* src, int* lines, Program* prog, SymTab* syms, int* err) {
+    *err = OK;
+    char* p = src;
+    int srcline = 1;
+    for (;;) {
+        while (isspace(*p)) { // parse extra lines/whitespace
+            if (*p == '\n') srcline++;
+            p++;
+        }
+
+        if (*p == 0) {
+            return;
+        }
+        int lineno = lines != NULL ? lines[srcline - 1] : srcline;
+
+        char* end = p;
+        while (*end != 0 && *end != '\n') end++;
+
+        char* s = p;
+        char* e = p;
+        if (*p == '#') {
+            p = end;
+            continue;
+        } else if (*p == '.') {
+            nextToken(&s, &e, end);
+            char* name = s + 1;
+            int len = e - s - 1;
+            nextToken(&s, &e, end);
+            if (len < 1) {
+                *err = BAD;
+            } else if (s != e) {
+                // a line with more after its name is a directive
+                e = s;
+                parseDirective(name, len, &s, &e, end, prog, syms, lineno, err);
+            } else {
+                addItem(prog, ITEM_LABEL, lineno)->label = intern(syms, name, len);
+            }
+        } else if (*p == '"') {
+            e = parseStrData(p, end, prog, addItem(prog, ITEM_DATA, lineno), err);
+        } else {
+            Item* item = addItem(prog, ITEM_INS, lineno);
+            nextToken(&s, &e, end);
+            item->op = classifyIns(s, e, err);
+            for (;;) {
+                if (*err != OK) break;
+                nextToken(&s, &e, end);
+                if (s == e) break;
+                parseOperand(s, e, prog, syms, item, err);
+            }
+        }
+        // nothing but whitespace may follow a line's item
+        if (*err == OK) {
+            nextToken(&s, &e, end);
+            if (s != e) *err = BAD;
+        }
+        if (*err != OK) {
+            toolPrintf("FATAL: BAD LINE %i \"%.*s\".\n", lineno, (int)(end - p), p);
+            return;
+        }
+        p = end;
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <ctype.h>
+#include "ir.h"
+
+Expr* parseExpr(char* s, char* e, Arena* arena, SymTab* syms, int* err);
+void tokenize(char* src, int* lines, Program* prog, SymTab* syms, int* err);
@@ -0,0 +1,317 @@
+/* LINKER */
+#include "link.h"
+
+enum {
+    OK,
+    BAD,
+};
+
+/*
+LINKER
+mlink combines object files (see obj.c) into an image. The first atom of the first object file is placed at 0,
+since that is where the VM starts; after that, only atoms which can be reached from it are kept:
+those with a label used by a relocation in a kept atom, and those a kept atom falls through into.
+Kept atoms are laid out in the order they were given, followed by those which only reserve zeros,
+which take up no room in the image. Labels are moved along with their atoms, and then the relocations are evaluated.
+
+Global labels share one symbol table across every object file, and each file's other labels are private to it.
+A symbol's index is the object file which defines it, and its position is first within that file, then in the image.
+*/
+
+typedef struct {
+    int start;
+    int end;
+    int flags;      // OBJ_FALLTHROUGH, OBJ_RESERVED
+    int align;      // log2
+    int live;
+    int base;       // position in the image
+    int reloc;      // first relocation within the atom
+} Atom;
+
+typedef struct {
+    int at;
+    int size;
+    Expr* expr;
+} Reloc;
+
+typedef struct {
+    char* image;
+    int size;
+    int end;        // size, plus the zeros reserved after the image
+    int nsyms;
+    Sym** syms;
+    int natoms;
+    Atom* atoms;
+    int nrelocs;
+    Reloc* relocs;
+} Module;
+
+#define EXPR_DEPTH 64
+
+Expr* getExpr(Reader* in, Module* m, Arena* arena, int depth) {
+    Expr* x = arenaZalloc(arena, sizeof(Expr));
+    if (depth == EXPR_DEPTH) {
+        in->bad = 1;
+        return x;
+    }
+    x->kind = getU8(in);
+    switch (x->kind) {
+    case EXPR_NUM:
+        x->num = getU32(in);
+        break;
+    case EXPR_LABEL: {
+        uint32_t s = getU32(in);
+        if (s >= (uint32_t)m->nsyms) {
+            in->bad = 1;
+            x->kind = EXPR_NUM;
+            break;
+        }
+        x->sym = m->syms[s];
+        break;
+    }
+    case EXPR_NEG: case EXPR_HI: case EXPR_LO:
+        x->a = getExpr(in, m, arena, depth + 1);
+        break;
+    case EXPR_ADD: case EXPR_SUB: case EXPR_SHL: case EXPR_SHR:
+        x->a = getExpr(in, m, arena, depth + 1);
+        x->b = getExpr(in, m, arena, depth + 1);
+        break;
+    default:
+        in->bad = 1;
+        x->kind = EXPR_NUM;
+        break;
+    }
+    return x;
+}
+
+void readModule(char* obj, long size, int index, Module* m, SymTab* globals, Arena* arena, int* err) {
+    Reader in = {obj, obj + size, 0};
+    if (size < 4 || memcmp(obj, OBJ_MAGIC, 4) != 0) {
+        *err = BAD;
+        return;
+    }
+    in.p += 4;
+
+    m->size = getU32(&in);
+    if (in.end - in.p < m->size) {
+        *err = BAD;
+        return;
+    }
+    m->image = in.p;
+    in.p += m->size;
+    m->end = m->size + getU32(&in);
+    if (m->end < m->size || m->end > 65536) {
+        *err = BAD;
+        return;
+    }
+
+    SymTab* locals = arenaZalloc(arena, sizeof(SymTab));
+    locals->arena = arena;
+    m->nsyms = getU32(&in);
+    if (in.end - in.p < m->nsyms) {
+        *err = BAD;
+        return;
+    }
+    m->syms = arenaAlloc(arena, m->nsyms * sizeof(Sym*));
+    for (int s = 0; s < m->nsyms; s++) {
+        int flags = getU8(&in);
+        int len = getU16(&in);
+        if (in.end - in.p < len) {
+            *err = BAD;
+            return;
+        }
+        char* name = in.p;
+        in.p += len;
+        uint32_t pos = getU32(&in);
+        Sym* sym = intern(flags & OBJ_GLOBAL ? globals : locals, name, len);
+        if (flags & OBJ_DEFINED) {
+            if (sym->index >= 0 || pos > (uint32_t)m->end) {
+                printf("FATAL: LABEL \"%s\" DEFINED TWICE.\n", sym->name);
+                *err = BAD;
+                return;
+            }
+            sym->pos = pos;
+            sym->index = index;
+        }
+        m->syms[s] = sym;
+    }
+
+    m->natoms = getU32(&in);
+    if (in.end - in.p < m->natoms) {
+        *err = BAD;
+        return;
+    }
+    m->atoms = arenaZalloc(arena, m->natoms * sizeof(Atom));
+    for (int a = 0; a < m->natoms; a++) {
+        m->atoms[a].start = getU32(&in);
+        m->atoms[a].flags = getU8(&in);
+        m->atoms[a].align = getU8(&in);
+        if (a > 0) m->atoms[a - 1].end = m->atoms[a].start;
+        if (m->atoms[a].align > 15 || m->atoms[a].start > m->end || (a > 0 && m->atoms[a].start < m->atoms[a - 1].start)) in.bad = 1;
+    }
+    if (m->natoms > 0) m->atoms[m->natoms - 1].end = m->end;
+
+    m->nrelocs = getU32(&in);
+    if (in.end - in.p < m->nrelocs) {
+        *err = BAD;
+        return;
+    }
+    m->relocs = arenaAlloc(arena, m->nrelocs * sizeof(Reloc));
+    int a = 0;
+    for (int r = 0; r < m->nrelocs; r++) {
+        Reloc* reloc = &m->relocs[r];
+        reloc->at = getU32(&in);
+        reloc->size = getU8(&in);
+        reloc->expr = getExpr(&in, m, arena, 0);
+        if (reloc->size < 1 || reloc->size > 4 || reloc->at < 0 || reloc->at + reloc->size > m->size
+                || (r > 0 && reloc->at < m->relocs[r - 1].at)) {
+            in.bad = 1;
+            break;
+        }
+        while (a < m->natoms && m->atoms[a].end <= reloc->at) m->atoms[++a].reloc = r;
+    }
+    while (a < m->natoms - 1) m->atoms[++a].reloc = m->nrelocs;
+
+    if (in.bad || m->natoms == 0 || m->atoms[0].start != 0) {
+        *err = BAD;
+    }
+}
+
+// the atom of a module holding a position
+int atomAt(Module* m, int pos) {
+    int lo = 0;
+    int hi = m->natoms - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (m->atoms[mid].start <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+typedef struct {
+    int module;
+    int atom;
+} AtomRef;
+
+typedef struct {
+    AtomRef* refs;
+    int count;
+} Worklist;
+
+void keep(Module* mods, Worklist* work, int module, int atom) {
+    Atom* a = &mods[module].atoms[atom];
+    if (a->live) return;
+    a->live = 1;
+    work->refs[work->count++] = (AtomRef){module, atom};
+}
+
+int keepExpr(Module* mods, Worklist* work, Expr* x) {
+    switch (x->kind) {
+    case EXPR_NUM:
+        return OK;
+    case EXPR_LABEL:
+        if (x->sym->index < 0) {
+            printf("FATAL: LABEL \"%s\" NOT FOUND.\n", x->sym->name);
+            return BAD;
+        }
+        keep(mods, work, x->sym->index, atomAt(&mods[x->sym->index], x->sym->pos));
+        return OK;
+    default:
+        if (keepExpr(mods, work, x->a) != OK) return BAD;
+        return x->b == NULL ? OK : keepExpr(mods, work, x->b);
+    }
+}
+
+void linkObjects(char** objs, long* sizes, int n, Arena* arena, Buf* out, int* err) {
+    *err = OK;
+    bufPut(out, "", 0);
+    SymTab globals = {arena, NULL, 0, 0};
+    Module* mods = arenaZalloc(arena, n * sizeof(Module));
+    int total = 0;
+    for (int m = 0; m < n; m++) {
+        readModule(objs[m], sizes[m], m, &mods[m], &globals, arena, err);
+        if (*err != OK) {
+            printf("FATAL: BAD OBJECT FILE %i.\n", m);
+            return;
+        }
+        total += mods[m].natoms;
+    }
+    if (n == 0) return;
+
+    Worklist work = {arenaAlloc(arena, total * sizeof(AtomRef)), 0};
+    keep(mods, &work, 0, 0);
+    while (work.count > 0) {
+        AtomRef ref = work.refs[--work.count];
+        Module* m = &mods[ref.module];
+        Atom* a = &m->atoms[ref.atom];
+        int end = ref.atom + 1 < m->natoms ? m->atoms[ref.atom + 1].reloc : m->nrelocs;
+        for (int r = a->reloc; r < end; r++) {
+            if (keepExpr(mods, &work, m->relocs[r].expr) != OK) {
+                *err = BAD;
+                return;
+            }
+        }
+        if ((a->flags & OBJ_FALLTHROUGH) && ref.atom + 1 < m->natoms) {
+            keep(mods, &work, ref.module, ref.atom + 1);
+        }
+    }
+
+    // atoms with bytes in them first, then reservations. zeros are only written once something follows them
+    int reserved = 0;
+    int kept = 0;
+    int size = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int m = 0; m < n; m++) {
+            if (pass == 0) size += mods[m].end;
+            for (int a = 0; a < mods[m].natoms; a++) {
+                Atom* atom = &mods[m].atoms[a];
+                if (!atom->live || (atom->flags & OBJ_RESERVED) != pass * OBJ_RESERVED) continue;
+                int pos = out->len + reserved;
+                atom->base = pos + ((atom->start - pos) & ((1 << atom->align) - 1));
+                reserved += atom->base - pos + atom->end - atom->start;
+                kept += atom->end - atom->start;
+                int bytes = (atom->end < mods[m].size ? atom->end : mods[m].size) - atom->start;
+                if (pass == 0 && bytes > 0) {
+                    bufZero(out, reserved - (atom->end - atom->start));
+                    bufPut(out, mods[m].image + atom->start, bytes);
+                    reserved = atom->end - atom->start - bytes;
+                }
+            }
+        }
+    }
+    if (out->len + reserved > 65536) {
+        printf("FATAL: LINKED PROGRAM NEEDS %li BYTES OF MEMORY.\n", out->len + reserved);
+        *err = BAD;
+        return;
+    }
+    for (int m = 0; m < n; m++) {
+        for (int s = 0; s < mods[m].nsyms; s++) {
+            Sym* sym = mods[m].syms[s];
+            if (sym->index != m) continue;
+            Atom* atom = &mods[m].atoms[atomAt(&mods[m], sym->pos)];
+            sym->pos = atom->base + sym->pos - atom->start;
+            sym->index = -2;    // moved
+        }
+    }
+    for (int m = 0; m < n; m++) {
+        for (int a = 0; a < mods[m].natoms; a++) {
+            Atom* atom = &mods[m].atoms[a];
+            if (!atom->live) continue;
+            int end = a + 1 < mods[m].natoms ? mods[m].atoms[a + 1].reloc : mods[m].nrelocs;
+            for (int r = atom->reloc; r < end; r++) {
+                Reloc* reloc = &mods[m].relocs[r];
+                int value;
+                evalExpr(reloc->expr, &value, 1, 0, 0);
+                if (!fitsField(value, reloc->size)) {
+                    printf("FATAL: %i DOESN'T FIT IN %i BYTES, AT %i IN OBJECT FILE %i.\n", value, reloc->size, reloc->at, m);
+                    *err = BAD;
+                    return;
+                }
+                int at = atom->base + reloc->at - atom->start;
+                for (int b = 0; b < reloc->size; b++) out->data[at + b] = (value >> 8*b) & 0xff;
+            }
+        }
+    }
+    printf("KEPT %i OF %i BYTES FROM %i OBJECT FILES\n", kept, size, n);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "obj.h"
+
+void linkObjects(char** objs, long* sizes, int n, Arena* arena, Buf* out, int* err);
@@ -0,0 +1,153 @@
+#include "aot.h"
+#include "verify.h"
+#include "fuse.h"
+#include <stdlib.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+TRANSLATING IMAGES
+The image is verified as the VM would, and each verified block becomes a function, see aot.c.
+A block can be entered at any of its instructions, so its function starts with a switch on the pc,
+falling through from each instruction to the next.
+Blocks longer than the verifier can count are split, so that the check made before running one always covers all of it.
+Register operations and static branches are written out with their operands; anything else uses its DO_ macro.
+A slot of two 16-bit instructions is translated as both of the instructions they stand for, see compress.c,
+unless a block can't carry on after the first, such as a store or branch: the slot then ends its block,
+and the block's function returns after the first half.
+*/
+
+// writes out an instruction ending at next, the last of its block or not
+void translate(FILE* out, VM* vm, uint16_t addr, uint8_t* ins, uint16_t next, int last) {
+    char* names[] = OP_NAMES;
+    uint8_t op = ins[0];
+    uint8_t a1 = ins[1];
+    uint8_t a2 = ins[2];
+    uint8_t a3 = ins[3];
+    int half = next - addr == 2;
+    char* binop = NULL;
+    switch (op)
+    {
+    case AND: binop = "&"; break;
+    case OR: binop = "|"; break;
+    case XOR: binop = "^"; break;
+    case ADD: binop = "+"; break;
+    case SHIFTL: binop = "<<"; break;
+    case SHIFTR: binop = ">>"; break;
+    default: break;
+    }
+
+    fprintf(out, half && addr % 4 != 0 ? "                  " : "    case 0x%04x: ", addr);
+    if (half && (last || !continuesBlock(op) || op == LD8 || op == LD16 || op == LD32)) {
+        // runs as the 32-bit instruction before it would, see compress.c
+        fprintf(out, "pc = 0x%04x; ", (uint16_t)(addr - 2));
+    }
+    if (op == LIM) {
+        fprintf(out, "reg16[%i] = 0x%04x;", a1, a2 | a3 << 8);
+    } else if (binop != NULL) {
+        fprintf(out, "reg16[%i] = reg16[%i] %s reg16[%i];", a1, a2, binop, a3);
+    } else if (op == NOR) {
+        fprintf(out, "reg16[%i] = ~(reg16[%i] | reg16[%i]);", a1, a2, a3);
+    } else if (op == ADDC) {
+        fprintf(out, "reg16[%i] = reg16[%i] + reg16[%i] + 1;", a1, a2, a3);
+    } else if (op >= BEQ && op <= BGT && !half && (vm->vblock[addr / 4] & VERIFIED_TARGET)) {
+        char* cmp[] = {"==", "!=", "<", ">"};
+        fprintf(out, "if (reg16[%i] %s reg16[%i]) { pc = 0x%04x; cpu->branches++; }",
+            a1, cmp[op - BEQ], a2, (uint16_t)(addr + (int8_t)a3));
+    } else if (op >= BEQ && op <= BGT) {
+        fprintf(out, "{ int trusted = 0; DO_%s(%i, %i, %i) }", names[op], a1, a2, a3);
+    } else if (op != HLT) {
+        fprintf(out, "DO_%s(%i, %i, %i)", names[op], a1, a2, a3);
+    }
+    if (op == LD8 || op == LD16 || op == LD32) {
+        fprintf(out, " CHECK_INT(%s)", names[op]);
+    }
+    if (!last) {
+        fprintf(out, " NEXT(0x%04x)", next);
+    }
+    fprintf(out, "\n");
+}
+
+int main(int argc, char** argv) {
+    // maot -o out.c image.bin
+    if (argc < 4 || strcmp(argv[1], "-o") != 0) {
+        printf("not enough arguments");
+        return -1;
+    }
+
+    VM* vm = calloc(1, sizeof(VM));
+    vm->mem = calloc(65536, 1);
+    FILE* f = fopen(argv[3], "r");
+    if (f == NULL) {
+        printf("FATAL: COULDN'T OPEN %s\n", argv[3]);
+        return 1;
+    }
+    long size = fread(vm->mem, 1, 65536, f);
+    fclose(f);
+    verify(vm, size);
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("FATAL: COULDN'T OPEN %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(out, "// %s translated by maot, see aot.c\n", argv[3]);
+    fprintf(out, "#include \"aot.h\"\n#include \"ins.h\"\n\n");
+
+    uint8_t* lens = calloc(65536 / 4, 1);
+    uint16_t* starts = calloc(65536 / 4, sizeof(uint16_t));
+    uint8_t* vblock = vm->vblock;
+    int slots = size / 4;
+    int blocks = 0;
+    int translated = 0;
+    for (int slot = 0; slot < slots; slot++) {
+        if (vblock[slot] == 0) continue;
+        int end = slot;
+        while ((vblock[end] & VERIFIED_LEN) != 1 && end + 1 - slot < VERIFIED_LEN) end++;
+        for (int s = slot; s <= end; s++) {
+            lens[s] = end - s + 1;
+            starts[s] = slot;
+        }
+
+        fprintf(out, "static uint8_t b_%04x(CPU* cpu, uint16_t* pcp) {\n", slot * 4);
+        fprintf(out, "    BLOCK_STATE\n");
+        fprintf(out, "    switch (pc)\n    {\n");
+        uint8_t op = HLT;
+        for (int s = slot; s <= end; s++) {
+            uint8_t ins[2][4];
+            int n = decodeSlot(vm->mem + s * 4, ins);
+            for (int k = 0; k < n; k++) {
+                uint16_t addr = s * 4 + 2*k;
+                // a first half which doesn't carry on ends the block there, leaving run() to take its second half
+                int stop = k == n - 1 || !continuesBlock(ins[k][0]);
+                translate(out, vm, addr, ins[k], n == 1 ? addr + 4 : addr + 2, s == end && stop);
+                op = ins[k][0];
+                if (stop) break;
+            }
+        }
+        fprintf(out, "    }\n");
+        fprintf(out, "    *pcp = pc;\n");
+        fprintf(out, "    return %s;\n}\n\n", ((char*[])OP_NAMES)[op]);
+        blocks++;
+        translated += end - slot + 1;
+        slot = end;
+    }
+
+    fprintf(out, "Translation translation = {\n");
+    fprintf(out, "    AOT_VERSION, sizeof(VM), sizeof(CPU), 0x%016llxull, %li,\n", (unsigned long long)imageHash(vm->mem, size), size);
+    fprintf(out, "    .lens = {");
+    for (int s = 0; s < slots; s++) {
+        if (lens[s] != 0) fprintf(out, "%s[%i] = %i,", s % 16 == 0 ? "\n        " : " ", s, lens[s]);
+    }
+    fprintf(out, "\n    },\n    .blocks = {");
+    for (int s = 0; s < slots; s++) {
+        if (lens[s] != 0) fprintf(out, "%s[%i] = b_%04x,", s % 16 == 0 ? "\n        " : " ", s, starts[s] * 4);
+    }
+    fprintf(out, "\n    },\n};\n");
+    fclose(out);
+    printf("TRANSLATED %i SLOTS IN %i BLOCKS\n", translated, blocks);
+    return OK;
+}
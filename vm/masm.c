@@ -1,12 +1,139 @@
-#include "asm.h"
-#include "pre.h"
+#include "build.h"
+#include <stdlib.h>
+#include <pthread.h>
 
 enum {
     OK,
     BAD
 };
 
+/*
+BATCH ASSEMBLY
+With -j N, masm assembles every source it is given into a directory, on N threads.
+Each thread takes the next source not yet started until there are none left;
+an output is named after its source, with .asm replaced by .bin, or by .o with -c,
+so two sources with the same name in different directories are refused rather than raced into one output.
+The messages of each build are kept until they have all finished, and then printed in the order the sources were given,
+each line starting with its source.
+*/
+
+typedef struct {
+    char** ins;
+    char** outs;
+    char** logs;    // messages of each build, see toolOut in buf.h
+    int* statuses;
+    int count;
+    int next;       // next source to be started
+    int flags;
+} Batch;
+
+void* worker(void* arg) {
+    Batch* batch = arg;
+    for (;;) {
+        int j = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (j >= batch->count) return NULL;
+        size_t len;
+        toolOut = open_memstream(&batch->logs[j], &len);
+        batch->statuses[j] = buildFile(batch->ins[j], batch->outs[j], batch->flags);
+        if (toolOut != NULL) {
+            fclose(toolOut);
+            toolOut = NULL;
+        }
+    }
+}
+
+// the output in dir for a source
+char* outputName(char* dir, char* in, int object) {
+    char* base = strrchr(in, '/');
+    base = base == NULL ? in : base + 1;
+    long len = strlen(base);
+    if (len > 4 && strcmp(base + len - 4, ".asm") == 0) len -= 4;
+    char* out = malloc(strlen(dir) + len + 6);
+    sprintf(out, "%s/%.*s%s", dir, (int)len, base, object ? ".o" : ".bin");
+    return out;
+}
+
+// the index of an earlier source with the same output as source j, or -1
+int sameOutput(char** outs, int j) {
+    for (int k = 0; k < j; k++) {
+        if (strcmp(outs[j], outs[k]) == 0) return k;
+    }
+    return -1;
+}
+
+int runBatch(char* dir, char** ins, int count, int threads, int flags) {
+    char** outs = calloc(count, sizeof(char*));
+    int clashes = 0;
+    for (int j = 0; j < count; j++) {
+        outs[j] = outputName(dir, ins[j], flags & BUILD_OBJECT);
+        int k = sameOutput(outs, j);
+        if (k >= 0) {
+            printf("FATAL: %s AND %s WOULD BOTH BE ASSEMBLED INTO %s\n", ins[k], ins[j], outs[j]);
+            clashes++;
+        }
+    }
+    if (clashes > 0) {
+        for (int j = 0; j < count; j++) free(outs[j]);
+        free(outs);
+        return 1;
+    }
+
+    Batch batch = {ins, outs, calloc(count, sizeof(char*)), calloc(count, sizeof(int)), count, 0, flags};
+    if (threads > count) threads = count;
+    pthread_t* pool = calloc(threads, sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        pthread_create(pool + t, NULL, worker, &batch);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(pool[t], NULL);
+    }
+
+    int failed = 0;
+    for (int j = 0; j < count; j++) {
+        for (char* line = batch.logs[j]; line != NULL && *line != 0;) {
+            int len = strcspn(line, "\n");
+            printf("%s: %.*s\n", ins[j], len, line);
+            line += line[len] == 0 ? len : len + 1;
+        }
+        free(batch.logs[j]);
+        if (batch.statuses[j] != 0) {
+            printf("FAILED: %s\n", ins[j]);
+            failed++;
+        }
+        free(batch.outs[j]);
+    }
+    printf("ASSEMBLED %i OF %i FILES\n", count - failed, count);
+    free(pool);
+    free(batch.outs);
+    free(batch.logs);
+    free(batch.statuses);
+    return failed == 0 ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
+    // masm [-O] [-z] [-c] -o out.bin in.asm
+    // masm [-O] [-z] [-c] -j N -o outdir a.asm b.asm ...
+    int flags = BUILD_VERBOSE;
+    int threads = 0;
+    while (argc > 1 && (strcmp(argv[1], "-O") == 0 || strcmp(argv[1], "-z") == 0 || strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "-j") == 0)) {
+        if (argv[1][1] == 'O') {
+            flags |= BUILD_OPTIMIZE;
+        } else if (argv[1][1] == 'z') {
+            flags |= BUILD_COMPRESS;
+        } else if (argv[1][1] == 'c') {
+            flags |= BUILD_OBJECT;
+        } else {
+            if (argc < 3 || (threads = atoi(argv[2])) < 1) {
+                printf("-j needs a number of threads");
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
+        argv++;
+        argc--;
+    }
+
     if (argc < 2) {
         printf("not enough arguments");
         return -1;
@@ -17,31 +144,12 @@ int main(int argc, char** argv) {
             printf("not enough arguments");
             return -1;
         }
-
-        FILE* i = fopen(argv[3], "r");
-        FILE* tmp = fopen("tmp.rasm", "w+");
-        int error = OK;
-        preprocess(i, tmp, &error);
-        if (error != OK) {
-            printf("errored during demacro with code %i", error);
-            return 1;
-        }
-        fclose(tmp);
-        fclose(i);
-
-        FILE* tmp2 = fopen("tmp.rasm", "r");
-        FILE* o = fopen(argv[2], "w+");
-        assemble(tmp2, o, &error);
-        if (error != OK) {
-            printf("errored during assembly with code %i", error);
-            return 1;
+        if (threads > 0) {
+            return runBatch(argv[2], argv + 3, argc - 3, threads, flags & ~BUILD_VERBOSE);
         }
-        fclose(tmp2);
-        fclose(o);
-        
-        return 0;
+        return buildFile(argv[3], argv[2], flags);
     } else {
         printf("unrecognised command %s", argv[1]);
         return 2;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+/* VM METRICS EXPORT */
+#include "metrics.h"
+#include "watch.h"
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+METRICS
+With -m file, vm rewrites file every METRICS_PERIOD milliseconds with the counters of the VMs it is running,
+in the Prometheus text format; with -u socket, it instead answers HTTP requests on a unix socket with them,
+e.g. curl --unix-socket socket http://vm/metrics.
+Both are done by a background thread, which only reads the counters the cpus already keep (see vm.c),
+so that the guest runs as fast with them as without.
+
+The cpus' counters are 32 bits and wrap around; the thread adds up how much they have moved since each sample,
+so that the exported ones are 64 bits, and only wrap if a counter moves by 2^32 between samples.
+Each VM's series are labelled with vm="n", 0 being the main VM and the others its clones, for as long as they run.
+
+rofth_instructions_total        instructions retired
+rofth_instructions_per_second   over the last period
+rofth_memory_exceptions_total
+rofth_interrupts_total          by interrupt code
+rofth_console_bytes_total       bytes written to the console
+rofth_process                   process running on each cpu
+rofth_vms_dropped_total         VMs left out, as METRICS_VMS were already being watched
+*/
+
+// what has been counted of a VM since it was attached
+typedef struct {
+    VM* vm;
+    int id;
+    uint32_t last[35];          // counters at the last sample: instructions, memory exceptions, console bytes, interrupts by code
+    uint64_t total[35];
+    uint64_t lastIns;           // instructions and time when instructions per second was last worked out
+    uint64_t lastNs;
+    double ips;
+} Watched;
+
+#define M_INS 0
+#define M_MEMEXC 1
+#define M_WRITTEN 2
+#define M_INTS 3
+
+struct Metrics {
+    pthread_mutex_t lock;       // guards vms, so that a VM isn't freed while being sampled
+    Watched vms[METRICS_VMS];
+    int nextId;
+    uint64_t dropped;           // VMs which couldn't be watched, as there was no room left for them
+    char* path;
+    int listener;               // socket served on, or -1
+    int stop[2];                // pipe written to stop the thread
+    pthread_t thread;
+};
+
+// brings the totals of w up to date
+void sample(Watched* w) {
+    uint32_t now[35] = {0};
+    for (int i = 0; i < w->vm->ncpus; i++) {
+        CPU* cpu = w->vm->cpus + i;
+        for (int p = 0; p < MAX_PROC; p++) {
+            now[M_INS] += __atomic_load_n(&cpu->retired[p], __ATOMIC_RELAXED);
+        }
+        now[M_MEMEXC] += __atomic_load_n(&cpu->memexcs, __ATOMIC_RELAXED);
+        now[M_WRITTEN] += __atomic_load_n(&cpu->written, __ATOMIC_RELAXED);
+        for (int c = 0; c < 32; c++) {
+            now[M_INTS + c] += __atomic_load_n(&cpu->intsBy[c], __ATOMIC_RELAXED);
+        }
+    }
+    for (int k = 0; k < 35; k++) {
+        w->total[k] += (uint32_t)(now[k] - w->last[k]);
+        w->last[k] = now[k];
+    }
+
+    uint64_t ns = nowNs();
+    if (ns - w->lastNs >= METRICS_PERIOD * 1000000ull) {
+        w->ips = (w->total[M_INS] - w->lastIns) * 1e9 / (ns - w->lastNs);
+        w->lastIns = w->total[M_INS];
+        w->lastNs = ns;
+    }
+}
+
+// samples every VM and prints their metrics to f
+void printMetrics(Metrics* m, FILE* f) {
+    static char* names[] = {"rofth_instructions_total", "rofth_memory_exceptions_total", "rofth_console_bytes_total"};
+    static char* helps[] = {"Instructions retired.", "Memory exceptions raised.", "Bytes written to the console."};
+
+    pthread_mutex_lock(&m->lock);
+    for (int j = 0; j < METRICS_VMS; j++) {
+        if (m->vms[j].vm != NULL) sample(m->vms + j);
+    }
+    for (int k = M_INS; k < M_INTS; k++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", names[k], helps[k], names[k]);
+        for (int j = 0; j < METRICS_VMS; j++) {
+            if (m->vms[j].vm != NULL) fprintf(f, "%s{vm=\"%i\"} %" PRIu64 "\n", names[k], m->vms[j].id, m->vms[j].total[k]);
+        }
+    }
+    fprintf(f, "# HELP rofth_instructions_per_second Instructions retired per second.\n# TYPE rofth_instructions_per_second gauge\n");
+    for (int j = 0; j < METRICS_VMS; j++) {
+        if (m->vms[j].vm != NULL) fprintf(f, "rofth_instructions_per_second{vm=\"%i\"} %.0f\n", m->vms[j].id, m->vms[j].ips);
+    }
+    fprintf(f, "# HELP rofth_interrupts_total Interrupts taken.\n# TYPE rofth_interrupts_total counter\n");
+    for (int j = 0; j < METRICS_VMS; j++) {
+        for (int c = 0; m->vms[j].vm != NULL && c < 32; c++) {
+            if (m->vms[j].total[M_INTS + c] != 0) {
+                fprintf(f, "rofth_interrupts_total{vm=\"%i\",code=\"%i\"} %" PRIu64 "\n", m->vms[j].id, c, m->vms[j].total[M_INTS + c]);
+            }
+        }
+    }
+    fprintf(f, "# HELP rofth_process Process running on the cpu.\n# TYPE rofth_process gauge\n");
+    for (int j = 0; j < METRICS_VMS; j++) {
+        VM* vm = m->vms[j].vm;
+        for (int i = 0; vm != NULL && i < vm->ncpus; i++) {
+            fprintf(f, "rofth_process{vm=\"%i\",cpu=\"%i\"} %i\n", m->vms[j].id, i, (uint8_t)vm->mem[vm->cpus[i].ctl]);
+        }
+    }
+    fprintf(f, "# HELP rofth_vms_dropped_total VMs left out of the metrics, as too many were being watched.\n# TYPE rofth_vms_dropped_total counter\n");
+    fprintf(f, "rofth_vms_dropped_total %" PRIu64 "\n", m->dropped);
+    pthread_mutex_unlock(&m->lock);
+}
+
+// replaces the file at m->path, so that readers never see half of it
+void writeMetrics(Metrics* m) {
+    char* tmp = malloc(strlen(m->path) + 5);
+    sprintf(tmp, "%s.tmp", m->path);
+    FILE* f = fopen(tmp, "w");
+    if (f == NULL) {
+        free(tmp);
+        return;
+    }
+    printMetrics(m, f);
+    fclose(f);
+    rename(tmp, m->path);
+    free(tmp);
+}
+
+// answers one request on the socket with the metrics, whatever it asks for
+void serveMetrics(Metrics* m) {
+    int fd = accept(m->listener, NULL, NULL);
+    if (fd == -1) return;
+    char req[1024];
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 100) == 1) {
+        read(fd, req, sizeof(req));
+    }
+    char* body;
+    size_t len;
+    FILE* f = open_memstream(&body, &len);
+    printMetrics(m, f);
+    fclose(f);
+    dprintf(fd, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+    write(fd, body, len);
+    close(fd);
+    free(body);
+}
+
+void* exporter(void* arg) {
+    Metrics* m = arg;
+    struct pollfd fds[2] = {{m->stop[0], POLLIN, 0}, {m->listener, POLLIN, 0}};
+    for (;;) {
+        int n = poll(fds, m->listener == -1 ? 1 : 2, METRICS_PERIOD);
+        if (fds[0].revents != 0) return NULL;
+        if (m->listener == -1) {
+            writeMetrics(m);
+        } else if (n > 0 && fds[1].revents != 0) {
+            serveMetrics(m);
+        } else {
+            // keeps instructions per second, and the wrapping of the counters, up to date between requests
+            pthread_mutex_lock(&m->lock);
+            for (int j = 0; j < METRICS_VMS; j++) {
+                if (m->vms[j].vm != NULL) sample(m->vms + j);
+            }
+            pthread_mutex_unlock(&m->lock);
+        }
+    }
+}
+
+// exports metrics to the file at path, or on the unix socket at path if serve is set
+Metrics* metricsStart(char* path, int serve) {
+    Metrics* m = calloc(1, sizeof(Metrics));
+    pthread_mutex_init(&m->lock, NULL);
+    m->path = path;
+    m->listener = -1;
+    if (serve) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            printf("FATAL: SOCKET PATH TOO LONG %s\n", path);
+            free(m);
+            return NULL;
+        }
+        strcpy(addr.sun_path, path);
+        unlink(path);
+        m->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m->listener == -1 || bind(m->listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m->listener, 8) != 0) {
+            printf("FATAL: COULDN'T SERVE METRICS ON %s\n", path);
+            if (m->listener != -1) close(m->listener);
+            free(m);
+            return NULL;
+        }
+    }
+    pipe(m->stop);
+    pthread_create(&m->thread, NULL, exporter, m);
+    return m;
+}
+
+void metricsAttach(Metrics* m, VM* vm) {
+    if (m == NULL) return;
+    pthread_mutex_lock(&m->lock);
+    int j = 0;
+    while (j < METRICS_VMS && m->vms[j].vm != NULL) j++;
+    if (j < METRICS_VMS) {
+        memset(m->vms + j, 0, sizeof(Watched));
+        m->vms[j].vm = vm;
+        m->vms[j].id = m->nextId++;
+        m->vms[j].lastNs = nowNs();
+    } else {
+        m->dropped++;
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+// stops watching vm, which may then be freed
+void metricsDetach(Metrics* m, VM* vm) {
+    if (m == NULL) return;
+    pthread_mutex_lock(&m->lock);
+    for (int j = 0; j < METRICS_VMS; j++) {
+        if (m->vms[j].vm == vm) m->vms[j].vm = NULL;
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+// stops the thread, leaving the file with the final counters
+void metricsStop(Metrics* m) {
+    if (m == NULL) return;
+    write(m->stop[1], "", 1);
+    pthread_join(m->thread, NULL);
+    if (m->listener == -1) {
+        writeMetrics(m);
+    } else {
+        close(m->listener);
+        unlink(m->path);
+    }
+    close(m->stop[0]);
+    close(m->stop[1]);
+    free(m);
+}
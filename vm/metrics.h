@@ -0,0 +1,13 @@
+#pragma once
+
+#include "vm.h"
+
+#define METRICS_VMS 64          // VMs which may be watched at once
+#define METRICS_PERIOD 1000     // milliseconds between samples
+
+typedef struct Metrics Metrics;
+
+Metrics* metricsStart(char* path, int serve);
+void metricsAttach(Metrics* m, VM* vm);
+void metricsDetach(Metrics* m, VM* vm);
+void metricsStop(Metrics* m);
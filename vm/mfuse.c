@@ -0,0 +1,120 @@
+#include "fuse.h"
+#include "aot.h"
+#include <stdlib.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+PICKING SUPERINSTRUCTIONS
+mfuse reads profiles written by vm -p, and writes the sequences which would have saved the most dispatches to fused.h.
+Running a sequence of N instructions as one saves N-1 dispatches each time it is run, so that is how they are ranked.
+Only sequences the VM can fuse are kept: those whose instructions, except the last, neither jump nor halt.
+*/
+
+typedef struct {
+    int ops[FUSED_LEN];
+    int len;
+    unsigned long long count;
+} Sequence;
+
+int findOp(char** names, char* name) {
+    for (int o = 0; o < NOPS; o++) {
+        if (strcmp(names[o], name) == 0) return o;
+    }
+    return -1;
+}
+
+int fusable(Sequence* s) {
+    for (int k = 0; k < s->len; k++) {
+        if (s->ops[k] == HLT) return 0;
+        if (k + 1 < s->len && !FUSABLE(s->ops[k])) return 0;
+    }
+    return 1;
+}
+
+int bySavings(const void* a, const void* b) {
+    const Sequence* x = a;
+    const Sequence* y = b;
+    unsigned long long sx = x->count * (x->len - 1);
+    unsigned long long sy = y->count * (y->len - 1);
+    return sx < sy ? 1 : sx > sy ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    // mfuse [-n N] -o fused.h a.prof b.prof ...
+    int max = 16;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        max = atoi(argv[2]);
+        if (max < 0 || max > TRANSLATED - FUSED) {
+            printf("-n takes between 0 and %i superinstructions", TRANSLATED - FUSED);
+            return -1;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 4 || strcmp(argv[1], "-o") != 0) {
+        printf("not enough arguments");
+        return -1;
+    }
+
+    char* names[] = OP_NAMES;
+    int cap = 256;
+    int count = 0;
+    Sequence* seqs = malloc(cap * sizeof(Sequence));
+    for (int i = 3; i < argc; i++) {
+        FILE* f = fopen(argv[i], "r");
+        if (f == NULL) {
+            printf("FATAL: COULDN'T OPEN PROFILE %s\n", argv[i]);
+            return 1;
+        }
+        char line[128];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            char n[FUSED_LEN][16];
+            Sequence s = {{-1, -1, -1}, 0, 0};
+            s.len = sscanf(line, "%llu %15s %15s %15s", &s.count, n[0], n[1], n[2]) - 1;
+            if (s.len < 2) continue;
+            for (int k = 0; k < s.len; k++) {
+                s.ops[k] = findOp(names, n[k]);
+            }
+            if (s.ops[0] < 0 || s.ops[1] < 0 || (s.len == 3 && s.ops[2] < 0) || !fusable(&s)) continue;
+
+            int j = 0;
+            while (j < count && memcmp(seqs[j].ops, s.ops, sizeof(s.ops)) != 0) j++;
+            if (j < count) {
+                seqs[j].count += s.count;
+                continue;
+            }
+            if (count == cap) {
+                cap *= 2;
+                seqs = realloc(seqs, cap * sizeof(Sequence));
+            }
+            seqs[count++] = s;
+        }
+        fclose(f);
+    }
+
+    qsort(seqs, count, sizeof(Sequence), bySavings);
+    if (count > max) count = max;
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("FATAL: COULDN'T OPEN %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(out, "// superinstructions run by the VM, see fuse.c. generated by mfuse from profiles of programs/\n");
+    for (int j = 0; j < count; j++) {
+        Sequence* s = seqs + j;
+        if (s->len == 2) {
+            fprintf(out, "FUSE2(%i, %s, %s)", j, names[s->ops[0]], names[s->ops[1]]);
+        } else {
+            fprintf(out, "FUSE3(%i, %s, %s, %s)", j, names[s->ops[0]], names[s->ops[1]], names[s->ops[2]]);
+        }
+        fprintf(out, "     // run %llu times\n", s->count);
+    }
+    fclose(out);
+    printf("PICKED %i SUPERINSTRUCTIONS\n", count);
+    return OK;
+}
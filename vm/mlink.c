@@ -0,0 +1,60 @@
+#include "link.h"
+
+enum {
+    OK,
+    BAD
+};
+
+int main(int argc, char** argv) {
+    // mlink -o out.bin a.o b.o ...
+    if (argc < 4 || strcmp(argv[1], "-o") != 0) {
+        printf("not enough arguments");
+        return -1;
+    }
+
+    int n = argc - 3;
+    char** objs = calloc(n, sizeof(char*));
+    long* sizes = calloc(n, sizeof(long));
+    int status = 0;
+    for (int m = 0; m < n; m++) {
+        FILE* i = fopen(argv[m + 3], "r");
+        if (i == NULL) {
+            printf("could not open %s", argv[m + 3]);
+            status = 1;
+            break;
+        }
+        objs[m] = mapFile(i, &sizes[m]);
+        fclose(i);
+        if (objs[m] == NULL) {
+            printf("could not map %s", argv[m + 3]);
+            status = 1;
+            break;
+        }
+    }
+
+    Arena arena = {NULL};
+    if (status == 0) {
+        int error = OK;
+        Buf bin = {&arena, NULL, 0, 0};
+        linkObjects(objs, sizes, n, &arena, &bin, &error);
+        if (error != OK) {
+            printf("errored during linking with code %i", error);
+            status = 1;
+        } else {
+            printf("OUTPUT FILE SIZE (bytes): %li\n", bin.len);
+            // a failed link leaves any old image as it was, rather than a truncated one, see buf.c
+            if (writeAtomically(argv[2], bin.data, bin.len) != OK) {
+                printf("could not write %s\n", argv[2]);
+                status = 1;
+            }
+        }
+    }
+
+    arenaFree(&arena);
+    for (int m = 0; m < n; m++) {
+        if (objs[m] != NULL) unmapFile(objs[m], sizes[m]);
+    }
+    free(objs);
+    free(sizes);
+    return status;
+}
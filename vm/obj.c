@@ -0,0 +1,261 @@
+/* ASSEMBLER OBJECT FILES */
+#include "obj.h"
+
+enum {
+    OK,
+    BAD,
+};
+
+/*
+OBJECT FILES
+With -c, masm writes a relocatable object file instead of an image, for mlink to combine with others (see link.c).
+Every operand using a label is left as a relocation, holding the operand's expression with constants written out,
+since where any label ends up is only known once the linker has laid out the image.
+Labels exported with .global can be used by other object files; labels used but not defined are imported.
+
+The image is cut into atoms at each label, which the linker keeps or drops as a whole. A numeric branch offset
+must not be broken up, so a label which such an offset crosses does not start an atom.
+An atom which does not end in HLT or an unconditional branch may fall through into the next, and so keeps it alive;
+a jal is assumed not to return into the start of a .global label, so that exported functions are separate atoms.
+
+An atom which only reserves zeros is marked as such, so that the linker can move it past the end of the image.
+An atom is placed at the same position modulo its alignment as it had in the object file, so that .aligns in it still hold.
+
+All numbers are little-endian:
+    magic       "RFO2"
+    image       u32 size, then size bytes, then u32 number of zeros reserved after them
+    symbols     u32 count, then for each: u8 flags, u16 name length, name, u32 position or OBJ_UNDEFINED
+    atoms       u32 count, then for each: u32 start, u8 flags, u8 log2 of its alignment
+    relocations u32 count, then for each: u32 position, u8 size in bytes, expression
+An expression is a u8 EXPR_ kind, then a u32 number for EXPR_NUM, a u32 symbol for EXPR_LABEL,
+or else its one or two operands.
+*/
+
+#define INLINE_DEPTH 64
+
+void putU8(Buf* out, uint8_t v) {
+    bufPutc(out, v);
+}
+
+void putU16(Buf* out, uint16_t v) {
+    char b[2] = {v & 0xff, v >> 8};
+    bufPut(out, b, 2);
+}
+
+void putU32(Buf* out, uint32_t v) {
+    char b[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24};
+    bufPut(out, b, 4);
+}
+
+uint8_t getU8(Reader* in) {
+    if (in->end - in->p < 1) {
+        in->bad = 1;
+        return 0;
+    }
+    return *in->p++;
+}
+
+uint16_t getU16(Reader* in) {
+    uint16_t lo = getU8(in);
+    return lo | getU8(in) << 8;
+}
+
+uint32_t getU32(Reader* in) {
+    uint32_t lo = getU16(in);
+    return lo | (uint32_t)getU16(in) << 16;
+}
+
+typedef struct {
+    Sym** syms;
+    int count;
+    int cap;
+    Arena* arena;
+} SymList;
+
+void addSym(SymList* list, Sym* sym) {
+    if (sym->index >= 0) return;
+    if (list->count == list->cap) {
+        list->cap = list->cap == 0 ? 64 : list->cap * 2;
+        Sym** grown = arenaAlloc(list->arena, list->cap * sizeof(Sym*));
+        if (list->count) memcpy(grown, list->syms, list->count * sizeof(Sym*));
+        list->syms = grown;
+    }
+    sym->index = list->count;
+    list->syms[list->count++] = sym;
+}
+
+// numbers the labels used by an expression
+int addExprSyms(SymList* list, Expr* x, int depth) {
+    if (depth == INLINE_DEPTH) return BAD;
+    switch (x->kind) {
+    case EXPR_NUM:
+        return OK;
+    case EXPR_LABEL:
+        addSym(list, x->sym);
+        return OK;
+    case EXPR_CONST:
+        return addExprSyms(list, x->sym->value, depth + 1);
+    default:
+        if (addExprSyms(list, x->a, depth) != OK) return BAD;
+        return x->b == NULL ? OK : addExprSyms(list, x->b, depth);
+    }
+}
+
+void putExpr(Buf* out, Expr* x) {
+    if (x->kind == EXPR_CONST) {
+        putExpr(out, x->sym->value);
+        return;
+    }
+    putU8(out, x->kind);
+    switch (x->kind) {
+    case EXPR_NUM:
+        putU32(out, x->num);
+        break;
+    case EXPR_LABEL:
+        putU32(out, x->sym->index);
+        break;
+    default:
+        putExpr(out, x->a);
+        if (x->b != NULL) putExpr(out, x->b);
+        break;
+    }
+}
+
+// whether execution can continue past an item
+int fallsThrough(Item* item) {
+    if (item->kind != ITEM_INS) return 1;
+    if (item->op == HLT) return 0;
+    return !(item->op == BEQ && checkOperands(item) && item->ops[0].imm == item->ops[1].imm);
+}
+
+// whether execution can continue past the last item of an atom into the labels starting at items[i].
+// a jal both calls and returns, so it is only taken to return to the next instruction if that is not
+// the start of an exported function, otherwise no function ending in a return could be stripped
+int fallsInto(Item* last, Program* prog, int i) {
+    if (last == NULL) return 1;
+    if (!fallsThrough(last)) return 0;
+    if (last->kind != ITEM_INS || last->op != LJAL) return 1;
+    for (; i < prog->count && prog->items[i].kind == ITEM_LABEL; i++) {
+        if (prog->items[i].label->global) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    int start;
+    int first;      // first item, the label starting the atom
+    Item* last;     // last item with something in it, or NULL
+    int reserved;   // whether it only reserves zeros
+    int falls;      // whether it falls through into the next atom
+    int align;      // log2 of the alignment it needs
+} ObjAtom;
+
+void writeObject(Program* prog, Buf* out, int* err) {
+    Buf image = {prog->arena, NULL, 0, 0};
+    Relocs relocs;
+    int total = assemble(prog, &image, &relocs, err);
+    if (*err != OK) return;
+
+    SymList list = {NULL, 0, 0, prog->arena};
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->items[i].kind == ITEM_LABEL) addSym(&list, prog->items[i].label);
+    }
+    for (int r = 0; r < relocs.count; r++) {
+        Item* item = relocs.fixups[r].item;
+        int o = relocs.fixups[r].o;
+        if (item->opkind[o] == OPND_SYM) {
+            addSym(&list, item->ops[o].sym);
+        } else if (addExprSyms(&list, item->ops[o].expr, 0) != OK) {
+            toolPrintf("FATAL: CONSTANT DEFINED IN TERMS OF ITSELF, ON LINE %i.\n", item->line);
+            *err = BAD;
+            return;
+        }
+    }
+
+    // mark the positions crossed by numeric offsets, which cannot start an atom
+    int* crossed = arenaZalloc(prog->arena, (total + 2) * sizeof(int));
+    int p = 0;
+    for (int i = 0; i < prog->count; i++) {
+        Item* item = &prog->items[i];
+        int base;
+        int o = offsetOperand(item, &base);
+        // a jal linking to the next instruction is a return point, which is left to fallsInto
+        if (o >= 0 && !(item->op == LJAL && item->ops[o].imm == 0)) {
+            int t = p + item->ops[o].imm + base;
+            int lo = t < p ? t : p;
+            int hi = t < p ? p : t;
+            lo = lo < 0 ? 0 : lo > total ? total : lo;
+            hi = hi < 0 ? 0 : hi > total ? total : hi;
+            crossed[lo + 1]++;
+            crossed[hi + 1]--;
+        }
+        p += itemSize(item, p);
+    }
+    for (int b = 1; b <= total; b++) crossed[b] += crossed[b - 1];
+
+    // atoms start at 0 and at every label not crossed by an offset
+    // an .align just before an atom's labels is there for the atom, so it takes on the alignment too
+    ObjAtom* atoms = arenaAlloc(prog->arena, (prog->count + 1) * sizeof(ObjAtom));
+    int natoms = 0;
+    int before = 0;
+    p = 0;
+    for (int i = 0; i < prog->count; i++) {
+        Item* item = &prog->items[i];
+        if (natoms == 0 || (item->kind == ITEM_LABEL && p != atoms[natoms - 1].start && !crossed[p])) {
+            atoms[natoms++] = (ObjAtom){p, i, NULL, 0, 0, before};
+        }
+        ObjAtom* atom = &atoms[natoms - 1];
+        if (item->kind == ITEM_LABEL) continue;
+        before = 0;
+        if (item->kind == ITEM_ALIGN) {
+            while ((1 << before) < item->len) before++;
+            if (before > atom->align) atom->align = before;
+        }
+        atom->reserved = (atom->last == NULL || atom->reserved) && isReserved(item);
+        atom->last = item;
+        p += itemSize(item, p);
+    }
+    if (natoms == 0) atoms[natoms++] = (ObjAtom){0, 0, NULL, 0, 0, 0};
+
+    // nothing falls into a reservation, which the linker may move. a fall through must keep the alignment of what it falls into
+    for (int a = natoms - 1; a >= 0; a--) {
+        ObjAtom* atom = &atoms[a];
+        atom->falls = !atom->reserved && a + 1 < natoms && !atoms[a + 1].reserved && fallsInto(atom->last, prog, atoms[a + 1].first);
+        if (atom->falls && atoms[a + 1].align > atom->align) atom->align = atoms[a + 1].align;
+    }
+
+    bufPut(out, OBJ_MAGIC, 4);
+    putU32(out, image.len);
+    bufPut(out, image.data, image.len);
+    putU32(out, total - image.len);
+
+    putU32(out, list.count);
+    for (int s = 0; s < list.count; s++) {
+        Sym* sym = list.syms[s];
+        putU8(out, (sym->pos >= 0 ? OBJ_DEFINED : 0) | (sym->global || sym->pos < 0 ? OBJ_GLOBAL : 0));
+        putU16(out, sym->len);
+        bufPut(out, sym->name, sym->len);
+        putU32(out, sym->pos >= 0 ? (uint32_t)sym->pos : OBJ_UNDEFINED);
+    }
+
+    putU32(out, natoms);
+    for (int a = 0; a < natoms; a++) {
+        putU32(out, atoms[a].start);
+        putU8(out, (atoms[a].falls ? OBJ_FALLTHROUGH : 0) | (atoms[a].reserved ? OBJ_RESERVED : 0));
+        putU8(out, atoms[a].align);
+    }
+
+    putU32(out, relocs.count);
+    for (int r = 0; r < relocs.count; r++) {
+        Fixup* f = &relocs.fixups[r];
+        Item* item = f->item;
+        putU32(out, f->at);
+        putU8(out, f->size);
+        if (item->opkind[f->o] == OPND_SYM) {
+            putU8(out, EXPR_LABEL);
+            putU32(out, item->ops[f->o].sym->index);
+        } else {
+            putExpr(out, item->ops[f->o].expr);
+        }
+    }
+}
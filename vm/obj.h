@@ -0,0 +1,28 @@
+#pragma once
+
+#include "asm.h"
+
+#define OBJ_MAGIC "RFO2"
+
+#define OBJ_DEFINED 1   // symbol flags
+#define OBJ_GLOBAL 2
+
+#define OBJ_UNDEFINED 0xffffffffu
+
+#define OBJ_FALLTHROUGH 1   // atom flags
+#define OBJ_RESERVED 2
+
+typedef struct {
+    char* p;
+    char* end;
+    int bad;        // set once anything is read past the end
+} Reader;
+
+void putU8(Buf* out, uint8_t v);
+void putU16(Buf* out, uint16_t v);
+void putU32(Buf* out, uint32_t v);
+uint8_t getU8(Reader* in);
+uint16_t getU16(Reader* in);
+uint32_t getU32(Reader* in);
+
+void writeObject(Program* prog, Buf* out, int* err);
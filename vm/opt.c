@@ -0,0 +1,570 @@
+/* ASSEMBLER PEEPHOLE OPTIMIZER */
+#include "opt.h"
+#include "compress.h"
+
+/*
+PEEPHOLE OPTIMIZER
+With -O, masm rewrites the program between preprocessing and encoding. Within each basic block it
+- drops LIMs of a value the register already holds,
+- folds arithmetic on registers with known values into a LIM, and drops arithmetic which changes nothing,
+- merges adjacent increments of a register, such as the two ADDCs of @call,
+- drops LIMs and arithmetic whose results are overwritten before being read,
+and across blocks it
+- decides branches on known values, and drops branches to the next instruction,
+- fuses a BEQ or BNE over an unconditional branch into a single inverted branch,
+- drops code which can only be reached by falling through an unconditional branch.
+
+Blocks begin at labels, data, the targets of branches, and after anything which transfers control.
+Registers are tracked as 16-bit values, but their effects are followed byte by byte,
+so that 8- and 32-bit loads and stores correctly clobber or read the 16-bit registers they overlap.
+Anything which can trap may run the interrupt handler, so it counts as reading every register.
+
+Label addresses are recomputed by the assembler anyway. Numeric branch, link and interrupt return offsets
+are resolved to the item they lead to before optimizing, and recomputed afterwards; if one leads
+somewhere other than the start of an item, everything it spans is left exactly as it was.
+Code addresses computed in any other way (such as by LIMs of numbers) are not supported.
+An offset spanning an .align freezes everything before the .align, so that its padding stays the same.
+*/
+
+#define DEAD 1      // removed from the program
+#define PINNED 2    // spanned by an offset which could not be resolved, or before a frozen .align, so must not move
+#define ENTRY 4     // may be reached other than by falling into it: labels, data and branch targets
+#define FOLLOW 8    // follows a transfer of control
+
+#define SCAN_LIMIT 64   // how far ahead to look for a register being read
+#define MAX_ROUNDS 8
+
+enum EFFECT {
+    PURE = 0,
+    TRAPS = 1,
+    CONTROL = 2,
+};
+
+typedef struct {
+    uint8_t kind;   // kind of the operand which was loaded, or 0 if unknown
+    Operand v;
+} Known;
+
+typedef struct {
+    Program* prog;
+    uint8_t* flags;
+    int* pos;       // position of each item before optimizing
+    int* target;    // item which a numeric offset leads to, or -1
+    int changed;
+    int removed;
+} Opt;
+
+typedef struct {
+    int valid;
+    int idx;        // the increment
+    int reg;        // register it increments
+    int by;
+    int between;    // a LIM since then, or -1
+} Increment;
+
+uint64_t regMask(int width, int n) {
+    if ((n + 1) * width > 64) return ~0ull;
+    return ((1ull << width) - 1) << (n * width);
+}
+
+#define REG8(n) regMask(1, n)
+#define REG16(n) regMask(2, n)
+#define REG32(n) regMask(4, n)
+
+int effects(Item* item, uint64_t* reads, uint64_t* writes) {
+    *reads = 0;
+    *writes = 0;
+    if (item->kind != ITEM_INS || !checkOperands(item)) {
+        *reads = ~0ull;
+        return TRAPS | CONTROL;
+    }
+    int a1 = item->ops[0].imm;
+    int a2 = item->ops[1].imm;
+    int a3 = item->ops[2].imm;
+    switch (item->op) {
+    case NOP:
+        return PURE;
+    case LIM:
+        *writes = REG16(a1);
+        return PURE;
+    case LD8:
+        *writes = REG8(a1);
+        *reads = REG16(a2);
+        return TRAPS;
+    case LD16:
+        *writes = REG16(a1);
+        *reads = REG16(a2);
+        return TRAPS;
+    case LD32:
+        *writes = REG32(a2);
+        *reads = REG16(a1);
+        return TRAPS;
+    case SV8:
+        *reads = REG8(a1) | REG16(a2);
+        return TRAPS;
+    case SV16:
+        *reads = REG16(a1) | REG16(a2);
+        return TRAPS;
+    case SV32:
+        *reads = REG32(a1) | REG16(a2);
+        return TRAPS;
+    case AND: case OR: case XOR: case NOR:
+    case ADD: case ADDC: case SHIFTL: case SHIFTR:
+        *writes = REG16(a1);
+        *reads = REG16(a2) | REG16(a3);
+        return PURE;
+    case LJAL:
+        *writes = REG16(a1);
+        *reads = REG16(a2);
+        return TRAPS | CONTROL;
+    case BEQ: case BNE: case BLT: case BGT:
+        *reads = REG16(a1) | REG16(a2);
+        return TRAPS | CONTROL;
+    case CAS:
+        *writes = REG16(a1);
+        *reads = REG16(a1) | REG16(a2) | REG16(a3);
+        return TRAPS;
+    case FADD:
+        *writes = REG16(a1);
+        *reads = REG16(a2) | REG16(a3);
+        return TRAPS;
+    default:    // HLT, INT, IPI
+        *reads = ~0ull;
+        return TRAPS | CONTROL;
+    }
+}
+
+int isBranchItem(Item* item) {
+    return item->kind == ITEM_INS && item->op >= BEQ && item->op <= BGT && checkOperands(item);
+}
+
+int isUnconditional(Opt* opt, int i) {
+    Item* item = &opt->prog->items[i];
+    return isBranchItem(item) && item->op == BEQ && item->ops[0].imm == item->ops[1].imm && opt->target[i] >= 0;
+}
+
+int nextLive(Opt* opt, int i) {
+    for (i++; i < opt->prog->count && (opt->flags[i] & DEAD); i++) continue;
+    return i;
+}
+
+// the first live item with something in it at or after i, which is where an offset to i now leads
+int landing(Opt* opt, int i) {
+    while (i < opt->prog->count && ((opt->flags[i] & DEAD) || itemSize(&opt->prog->items[i], opt->pos[i]) == 0)) i++;
+    return i;
+}
+
+void removeItem(Opt* opt, int i) {
+    opt->flags[i] |= DEAD;
+    opt->changed = 1;
+    opt->removed++;
+}
+
+// the first item with something in it at a position, or -1
+int itemAt(Opt* opt, int p) {
+    int lo = 0;
+    int hi = opt->prog->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (opt->pos[mid] < p) lo = mid + 1;
+        else hi = mid;
+    }
+    while (lo < opt->prog->count && opt->pos[lo] == p && itemSize(&opt->prog->items[lo], p) == 0) lo++;
+    if (lo == opt->prog->count) return p == opt->pos[lo] ? lo : -1;
+    return opt->pos[lo] == p ? lo : -1;
+}
+
+void setup(Opt* opt) {
+    Program* prog = opt->prog;
+    int n = prog->count;
+    opt->flags = arenaZalloc(prog->arena, n + 1);
+    opt->pos = arenaAlloc(prog->arena, (n + 1) * sizeof(int));
+    opt->target = arenaAlloc(prog->arena, (n + 1) * sizeof(int));
+    int p = 0;
+    for (int i = 0; i < n; i++) {
+        opt->pos[i] = p;
+        p += itemSize(&prog->items[i], p);
+    }
+    opt->pos[n] = p;
+
+    int* aligns = arenaAlloc(prog->arena, (n + 1) * sizeof(int));
+    int naligns = 0;
+    for (int i = 0; i < n; i++) {
+        if (prog->items[i].kind == ITEM_ALIGN) aligns[naligns++] = i;
+    }
+    int frozen = 0;
+
+    for (int i = 0; i < n; i++) {
+        Item* item = &prog->items[i];
+        uint64_t reads, writes;
+        opt->target[i] = -1;
+        if (item->kind != ITEM_INS) {
+            opt->flags[i] |= ENTRY;
+            opt->flags[i + 1] |= FOLLOW;
+        } else if (effects(item, &reads, &writes) & CONTROL) {
+            opt->flags[i + 1] |= FOLLOW;
+        }
+        int base;
+        int o = offsetOperand(item, &base);
+        if (o < 0) continue;
+        int t = opt->pos[i] + item->ops[o].imm + base;
+        int lo = t < opt->pos[i] ? t : opt->pos[i];
+        int hi = t < opt->pos[i] ? opt->pos[i] : t;
+        for (int a = 0; a < naligns; a++) {
+            int at = opt->pos[aligns[a]];
+            if (at > lo && at <= hi && aligns[a] > frozen) frozen = aligns[a];
+        }
+        opt->target[i] = itemAt(opt, t);
+        if (opt->target[i] >= 0) {
+            opt->flags[opt->target[i]] |= ENTRY;
+            if (item->op == INT) {
+                // the handler may return either to or after the given address
+                int after = itemAt(opt, t + 4);
+                if (after >= 0) opt->flags[after] |= ENTRY;
+            }
+            continue;
+        }
+        for (int j = 0; j < n; j++) {
+            if (opt->pos[j] >= lo && opt->pos[j] <= hi) opt->flags[j] |= PINNED | ENTRY;
+        }
+    }
+
+    // the padding of an .align which an offset spans must not change, so nothing before it may move
+    for (int j = 0; j < frozen; j++) opt->flags[j] |= PINNED;
+}
+
+int sameValue(Known* k, int kind, Operand v) {
+    if (k->kind != kind) return 0;
+    switch (kind) {
+    case OPND_IMM: return (k->v.imm & 0xffff) == (v.imm & 0xffff);
+    case OPND_SYM: return k->v.sym == v.sym;
+    case OPND_EXPR: return k->v.expr == v.expr;
+    default: return 0;
+    }
+}
+
+int isKnown(Known* known, int r, int* value) {
+    if (known[r].kind != OPND_IMM) return 0;
+    *value = known[r].v.imm & 0xffff;
+    return 1;
+}
+
+void forget(Known* known, uint64_t writes) {
+    for (int r = 0; r < 32; r++) {
+        if (REG16(r) & writes) known[r].kind = 0;
+    }
+}
+
+// finds a register known to hold a value, or -1
+int holding(Known* known, int value) {
+    for (int r = 0; r < 32; r++) {
+        int v;
+        if (isKnown(known, r, &v) && v == (value & 0xffff)) return r;
+    }
+    return -1;
+}
+
+int fold(int op, int a, int b, int* value) {
+    switch (op) {
+    case AND: *value = a & b; break;
+    case OR: *value = a | b; break;
+    case XOR: *value = a ^ b; break;
+    case NOR: *value = ~(a | b); break;
+    case ADD: *value = a + b; break;
+    case ADDC: *value = a + b + 1; break;
+    case SHIFTL: if (b >= 16) return 0; *value = a << b; break;
+    case SHIFTR: if (b >= 16) return 0; *value = a >> b; break;
+    default: return 0;
+    }
+    *value &= 0xffff;
+    return 1;
+}
+
+// whether op with a known right hand side leaves its left hand side unchanged
+int identity(int op, int b) {
+    switch (op) {
+    case ADD: case OR: case XOR: case SHIFTL: case SHIFTR:
+        return b == 0;
+    case AND:
+        return b == 0xffff;
+    default:
+        return 0;
+    }
+}
+
+// whether the bytes in mask, written by item i, are overwritten before anything might read them
+int deadAfter(Opt* opt, int i, uint64_t mask) {
+    Program* prog = opt->prog;
+    int scanned = 0;
+    for (int j = nextLive(opt, i); j < prog->count && scanned < SCAN_LIMIT; j = nextLive(opt, j), scanned++) {
+        if (opt->flags[j] & (ENTRY | FOLLOW)) return 0;
+        uint64_t reads, writes;
+        int fx = effects(&prog->items[j], &reads, &writes);
+        if ((reads & mask) || fx != PURE) return 0;
+        mask &= ~writes;
+        if (mask == 0) return 1;
+    }
+    return 0;
+}
+
+void rewriteLim(Item* item, int reg, int value) {
+    item->op = LIM;
+    item->nops = 2;
+    item->opkind[0] = OPND_REG;
+    item->ops[0].imm = reg;
+    item->opkind[1] = OPND_IMM;
+    item->ops[1].imm = value;
+}
+
+// constant propagation and increment merging, forward through each block
+void propagate(Opt* opt) {
+    Program* prog = opt->prog;
+    Known known[32];
+    Increment inc = {0};
+    memset(known, 0, sizeof(known));
+    for (int i = 0; i < prog->count; i++) {
+        uint8_t flags = opt->flags[i];
+        if (flags & DEAD) continue;
+        Item* item = &prog->items[i];
+        if ((flags & (ENTRY | FOLLOW)) || item->kind != ITEM_INS || !checkOperands(item)) {
+            memset(known, 0, sizeof(known));
+            inc.valid = 0;
+            if (item->kind != ITEM_INS || !checkOperands(item)) continue;
+        }
+        int pinned = flags & PINNED;
+        int a1 = item->ops[0].imm;
+        int a2 = item->ops[1].imm;
+        int a3 = item->ops[2].imm;
+        int va, vb, v;
+        uint64_t reads, writes;
+        int fx = effects(item, &reads, &writes);
+
+        switch (item->op) {
+        case LIM:
+            if (sameValue(&known[a1], item->opkind[1], item->ops[1]) && !pinned) {
+                removeItem(opt, i);
+                continue;
+            }
+            known[a1].kind = item->opkind[1];
+            known[a1].v = item->ops[1];
+            if (inc.valid && a1 != inc.reg && inc.between < 0) inc.between = i;
+            else inc.valid = 0;
+            continue;
+
+        case AND: case OR: case XOR: case NOR:
+        case ADD: case ADDC: case SHIFTL: case SHIFTR:
+            if (isKnown(known, a2, &va) && isKnown(known, a3, &vb) && fold(item->op, va, vb, &v)) {
+                inc.valid = 0;
+                if (isKnown(known, a1, &va) && va == v && !pinned) {
+                    removeItem(opt, i);
+                    continue;
+                }
+                rewriteLim(item, a1, v);
+                opt->changed = 1;
+                known[a1].kind = OPND_IMM;
+                known[a1].v.imm = v;
+                continue;
+            }
+            if (a1 == a2 && isKnown(known, a3, &vb) && identity(item->op, vb) && !pinned) {
+                removeItem(opt, i);
+                continue;
+            }
+            if ((item->op == ADD || item->op == ADDC) && a1 == a2 && a3 != a1 && isKnown(known, a3, &vb)) {
+                int by = vb + (item->op == ADDC);
+                int fused = 0;
+                if (inc.valid && inc.reg == a1 && !(opt->flags[inc.idx] & PINNED) && !pinned) {
+                    int total = (inc.by + by) & 0xffff;
+                    int r;
+                    if ((r = holding(known, total)) >= 0 && r != a1) {
+                        item->op = ADD;
+                        item->ops[2].imm = r;
+                        fused = 1;
+                    } else if ((r = holding(known, total - 1)) >= 0 && r != a1) {
+                        item->op = ADDC;
+                        item->ops[2].imm = r;
+                        fused = 1;
+                    } else if (inc.between >= 0 && prog->items[inc.between].ops[0].imm == a3
+                            && !(opt->flags[inc.between] & PINNED) && deadAfter(opt, i, REG16(a3))) {
+                        v = (item->op == ADDC ? total - 1 : total) & 0xffff;
+                        rewriteLim(&prog->items[inc.between], a3, v);
+                        known[a3].kind = OPND_IMM;
+                        known[a3].v.imm = v;
+                        fused = 1;
+                    }
+                    if (fused) {
+                        removeItem(opt, inc.idx);
+                        by = total;
+                    }
+                }
+                inc = (Increment){1, i, a1, by, -1};
+                forget(known, writes);
+                continue;
+            }
+            break;
+
+        case BEQ: case BNE: case BLT: case BGT: {
+            int decided = 0;
+            int taken = 0;
+            if (a1 == a2) {
+                decided = 1;
+                taken = item->op == BEQ;
+            } else if (isKnown(known, a1, &va) && isKnown(known, a2, &vb)) {
+                decided = 1;
+                switch (item->op) {
+                case BEQ: taken = va == vb; break;
+                case BNE: taken = va != vb; break;
+                case BLT: taken = va < vb; break;
+                case BGT: taken = va > vb; break;
+                }
+            }
+            if (decided && !taken && !pinned) {
+                removeItem(opt, i);
+                continue;
+            }
+            if (decided && taken && opt->target[i] >= 0 && !(item->op == BEQ && a1 == a2)) {
+                item->op = BEQ;
+                item->ops[1].imm = a1;
+                opt->changed = 1;
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        inc.valid = 0;
+        forget(known, writes);
+        if (fx != PURE) memset(known, 0, sizeof(known));
+    }
+}
+
+// branch folding and unreachable code
+void branches(Opt* opt) {
+    Program* prog = opt->prog;
+    for (int i = 0; i < prog->count; i++) {
+        if ((opt->flags[i] & (DEAD | PINNED)) || !isBranchItem(&prog->items[i]) || opt->target[i] < 0) continue;
+        Item* item = &prog->items[i];
+        int next = nextLive(opt, i);
+        if (landing(opt, opt->target[i]) == landing(opt, next)) {
+            removeItem(opt, i);
+            continue;
+        }
+        if ((item->op == BEQ || item->op == BNE) && item->ops[0].imm != item->ops[1].imm
+                && next < prog->count && isUnconditional(opt, next) && !(opt->flags[next] & (ENTRY | PINNED))
+                && landing(opt, opt->target[i]) == landing(opt, nextLive(opt, next))) {
+            int distance = opt->pos[opt->target[next]] - opt->pos[i] - 4;
+            if (distance >= -128 && distance <= 127) {
+                item->op = item->op == BEQ ? BNE : BEQ;
+                opt->target[i] = opt->target[next];
+                removeItem(opt, next);
+                next = nextLive(opt, i);
+            }
+        }
+        if (isUnconditional(opt, i)) {
+            for (int j = next; j < prog->count && !(opt->flags[j] & (ENTRY | PINNED)) && prog->items[j].kind == ITEM_INS; j = nextLive(opt, j)) {
+                removeItem(opt, j);
+            }
+        }
+    }
+}
+
+// results which are overwritten before being read
+void deadCode(Opt* opt) {
+    Program* prog = opt->prog;
+    for (int i = 0; i < prog->count; i++) {
+        if (opt->flags[i] & (DEAD | PINNED)) continue;
+        uint64_t reads, writes;
+        if (effects(&prog->items[i], &reads, &writes) != PURE || writes == 0) continue;
+        if (deadAfter(opt, i, writes)) removeItem(opt, i);
+    }
+}
+
+// drops removed items and recomputes numeric offsets
+void compact(Opt* opt) {
+    Program* prog = opt->prog;
+    int n = prog->count;
+    int* newpos = arenaAlloc(prog->arena, (n + 1) * sizeof(int));
+    int p = 0;
+    for (int i = 0; i < n; i++) {
+        newpos[i] = p;
+        if (!(opt->flags[i] & DEAD)) p += itemSize(&prog->items[i], p);
+    }
+    newpos[n] = p;
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        if (opt->flags[i] & DEAD) continue;
+        Item* item = &prog->items[i];
+        int base;
+        int o = offsetOperand(item, &base);
+        if (o >= 0 && opt->target[i] >= 0) {
+            item->ops[o].imm = newpos[opt->target[i]] - newpos[i] - base;
+        }
+        prog->items[c++] = *item;
+    }
+    prog->count = c;
+}
+
+// returns the number of items removed
+int optimize(Program* prog) {
+    Opt opt = {prog, NULL, NULL, NULL, 0, 0};
+    setup(&opt);
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        opt.changed = 0;
+        propagate(&opt);
+        branches(&opt);
+        deadCode(&opt);
+        if (!opt.changed) break;
+    }
+    compact(&opt);
+    return opt.removed;
+}
+
+/*
+COMPRESSION
+With -z, instructions which have a 16-bit form (see compress.c) are encoded in it, two at a time,
+after optimizing. A pair takes the place of one 32-bit instruction, so everything after it moves back
+by 4 bytes and keeps its alignment. The second of a pair is never an entry, so that labels, branch targets
+and return addresses all stay on 4-byte boundaries. Numeric offsets are resolved and recomputed as when
+optimizing, and nothing pinned is compressed. Branches are only compressed if their offset is a few bytes
+short of the limit, since it is now relative to the end of a 16-bit instruction.
+*/
+
+int compressible(Opt* opt, int i) {
+    Item* item = &opt->prog->items[i];
+    if (item->kind != ITEM_INS || (opt->flags[i] & (DEAD | PINNED)) || !checkOperands(item)) return 0;
+    uint8_t ins[4] = {item->op, 0, 0, 0};
+    for (int o = 0; o < item->nops; o++) {
+        if (item->opkind[o] != OPND_REG && item->opkind[o] != OPND_IMM) return 0;
+        ins[1 + o] = item->ops[o].imm & 0xff;
+    }
+    if (getInsType(item->op) == REG_IMM16) ins[3] = (item->ops[1].imm >> 8) & 0xff;
+    int base;
+    int o = offsetOperand(item, &base);
+    if (o >= 0 && (opt->target[i] < 0 || item->ops[o].imm < -120 || item->ops[o].imm > 120)) return 0;
+    char code[2];
+    return compressIns(ins, code) == 0;
+}
+
+// returns the number of pairs of instructions compressed
+int compress(Program* prog) {
+    Opt opt = {prog, NULL, NULL, NULL, 0, 0};
+    setup(&opt);
+    int pairs = 0;
+    int p = 0;
+    for (int i = 0; i < prog->count; i++) {
+        Item* item = &prog->items[i];
+        if (p % 4 == 0 && i + 1 < prog->count && !(opt.flags[i + 1] & ENTRY)
+                && compressible(&opt, i) && compressible(&opt, i + 1)) {
+            item->half = 1;
+            prog->items[i + 1].half = 1;
+            pairs++;
+            p += 4;
+            i++;
+            continue;
+        }
+        p += itemSize(item, p);
+    }
+    compact(&opt);
+    return pairs;
+}
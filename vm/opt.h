@@ -0,0 +1,6 @@
+#pragma once
+
+#include "ir.h"
+
+int optimize(Program* prog);
+int compress(Program* prog);
@@ -5,19 +5,9 @@ enum {
     BAD,
 };
 
-typedef struct _MacroMap{
-    struct _MacroMap* next;
-    char* defn;
-    char* macro;
-} MacroMap;
-
-MacroMap* allocMacro(char* defnp, int dlen, char* macrop, int nlen, MacroMap* old) {
-    MacroMap* tmp = malloc(sizeof(MacroMap) + dlen + nlen + 2);
-    char* defn = (char*)(tmp + 1);
-    char* macro = defn + dlen + 1;
-    tmp->defn = defn;
-    tmp->macro = macro;
-    tmp->next = old;
+void defineMacro(SymTab* syms, char* macrop, int nlen, char* defnp, int dlen) {
+    Sym* sym = intern(syms, macrop, nlen);
+    char* defn = arenaAlloc(syms->arena, dlen + 1);
     memcpy(defn, defnp, dlen);
     defn[dlen] = 0;
     for (int i = 0; i < dlen; i++) {
@@ -25,326 +15,259 @@ MacroMap* allocMacro(char* defnp, int dlen, char* macrop, int nlen, MacroMap* ol
             defn[i] = '\n';
         }
     }
-    memcpy(macro, macrop, nlen);
-    macro[nlen] = 0;
-    return tmp;
-}
-
-void freeMacro(MacroMap* map) {
-    if (map->next != NULL) {
-        freeMacro(map->next);
-    }
-    free(map);
+    sym->defn = defn;
 }
 
-char* indexMacro(char* name, MacroMap* map, int* err) {
-    if (strcmp(name, map->macro) == 0) {
-        return map->defn;
-    } else if (map->next != NULL) {
-        return indexMacro(name, map->next, err);
-    } else {
+// defines a constant from the text after '#!const', which is a name and then an expression
+void defineConst(SymTab* syms, char* defnp, int dlen, int* err) {
+    int nlen = 0;
+    while (nlen < dlen && !isspace(defnp[nlen])) nlen++;
+    Sym* sym = intern(syms, defnp, nlen);
+    if (nlen == 0 || sym->value != NULL) {
         *err = BAD;
-        return NULL;
+        toolPrintf("FATAL: BAD CONSTANT DEFINITION \"%.*s\".\n", dlen, defnp);
+        return;
+    }
+    sym->value = parseExpr(defnp + nlen, defnp + dlen, syms->arena, syms, err);
+    if (*err != OK) {
+        toolPrintf("FATAL: BAD CONSTANT DEFINITION \"%.*s\".\n", dlen, defnp);
     }
 }
 
-void debug_print_MacroMap(MacroMap* map) {
-    printf("Name: \"%s\", Defn: \"%s\"\n", map->macro, map->defn);
-    if (map->next != NULL) {
-        debug_print_MacroMap(map->next);
+void debug_print_Syms(SymTab* syms) {
+    for (int i = 0; i < syms->cap; i++) {
+        Sym* sym = syms->slots[i];
+        if (sym == NULL) continue;
+        if (sym->defn != NULL) {
+            toolPrintf("Name: \"%s\", Defn: \"%s\"\n", sym->name, sym->defn);
+        }
+        if (sym->pos >= 0) {
+            toolPrintf("Pos: %i, Label: \"%s\"\n", sym->pos, sym->name);
+        }
     }
 }
 
-MacroMap* macros(char* buf, int* err) {
-    MacroMap* macs = NULL;
+void macros(char* buf, SymTab* syms, int* err) {
     int i = 0;
     *err = OK;
     for (;;) {
-        if (buf[i] == 0) {
-            return macs;
-        } else if (buf[i] == '\n') {
-            i++;
-            if (buf[i] != '#') continue;
-            i++;
-            if (buf[i] != '!') continue;
-            i++;
+        // i is at the start of a line
+        if (buf[i] == '#' && buf[i+1] == '!') {
+            i += 2;
             int npos = i;
             int nlen = 0;
-            for (;!isspace(buf[i]);i++) nlen++;
-            i++;
+            for (;buf[i] != 0 && !isspace(buf[i]);i++) nlen++;
+            if (buf[i] != 0 && buf[i] != '\n') i++;
             int dpos = i;
             int dlen = 0;
-            for (;buf[i] != '\n';i++) dlen++;
+            for (;buf[i] != 0 && buf[i] != '\n';i++) dlen++;
 
-            macs = allocMacro(buf + dpos, dlen, buf + npos, nlen, macs);
-        } else {
-            i++;
+            if (nlen == 5 && memcmp(buf + npos, "const", 5) == 0) {
+                defineConst(syms, buf + dpos, dlen, err);
+                if (*err != OK) return;
+            } else {
+                defineMacro(syms, buf + npos, nlen, buf + dpos, dlen);
+            }
         }
-    }
-}
-
-void demacro(char* ibuf, FILE* out, MacroMap* macros, int* err) {
-    *err = OK;
-    int i = 0;
-    for (;;) {
-        if (ibuf[i] == 0) {
+        for (;buf[i] != 0 && buf[i] != '\n';i++) continue;
+        if (buf[i] == 0) {
             return;
-        } else if (ibuf[i] == '@') {
-            char macro[256];
-            i++;
-            int mpos = i;
-            int mlen = 0;
-            for (;!isspace(ibuf[i]);i++) {
-                macro[mlen] = ibuf[i];
-                mlen++;
-            }
-            macro[mlen] = 0;
-            char* defn = indexMacro(macro, macros, err);
-            if (*err != OK) {
-                printf("UNDEFINED MACRO \"%s\"\n", macro);
-                return;
-            }
-            int c = 0;
-            for(;defn[c] != 0;c++) putc(defn[c], out);
-        } else {
-            putc(ibuf[i], out);
-            i++;
         }
+        i++;
     }
 }
 
-typedef struct _LabelMap{
-    struct _LabelMap* next;
-    int inspos;
-    char label;
-} LabelMap;
+/*
+MACROS
+A macro is defined by a line '#!name body', where ';' in the body separates lines.
+'@name' expands a macro, and '@name(a, b, ...)' expands it with up to MACRO_ARGS arguments,
+which the body refers to as $1, $2, ... Arguments may themselves contain expansions,
+and '$@' in a body becomes a suffix unique to each expansion, for labels local to it.
 
-LabelMap* allocLabel(char* buf, int len, int pos, LabelMap* old) {
-    LabelMap* tmp = malloc(sizeof(LabelMap*) + sizeof(int) + len + 1);
-    tmp->inspos = pos;
-    tmp->next = old;
-    memcpy(&tmp->label, buf, len);
-    (&tmp->label)[len] = 0;
-    return tmp;
-}
+Expansion is a single pass straight into the output: a macro's body, and each argument it substitutes,
+are expanded recursively where they appear rather than being pasted in and rescanned.
+An argument is expanded in the context of the caller which passed it, so that $1 in an argument means the caller's $1.
+Each line of the output is mapped back to the source line it came from, so that errors name source lines:
+every line an expansion produces is put down to the line of its outermost '@'.
+*/
 
-void freeLabel(LabelMap* map) {
-    if (map->next != NULL) {
-        freeLabel(map->next);
-    }
-    free(map);
-}
+#define MACRO_ARGS 9
+#define MACRO_DEPTH 64
 
-int indexLabel(char* str, LabelMap* map, int* err) {
-    if (strcmp(str, &map->label) == 0) {
-        return map->inspos;
-    } else if (map->next != NULL) {
-        return indexLabel(str, map->next, err);
-    } else {
-        *err = BAD;
-        return 0;
+typedef struct Expansion Expansion;
+
+typedef struct {
+    char* text;
+    int len;
+    Expansion* ctx;     // expansion the argument was written in, or NULL at the top level
+} Arg;
+
+struct Expansion {
+    Sym* macro;
+    Arg args[MACRO_ARGS];
+    int nargs;
+    int id;             // unique number, for $@
+};
+
+typedef struct {
+    SymTab* syms;
+    Buf* out;
+    int expansions;     // number of expansions so far
+    Buf* lines;         // the source line of each line of out, as ints
+    int line;           // source line being expanded
+    int spanned;        // further source lines taken up by the arguments of calls on that line
+} Expander;
+
+// ends a line of the output, which came from the source line being expanded, and which ends it at the top level
+void endLine(Expander* ex, int depth) {
+    bufPut(ex->lines, (char*)&ex->line, sizeof(int));
+    if (depth == 0) {
+        ex->line += 1 + ex->spanned;
+        ex->spanned = 0;
     }
 }
 
-void debup_print_LabelMap(LabelMap* map) {
-    printf("Pos: %i, Label: \"%s\"\n", map->inspos, &map->label);
-    if (map->next != NULL) {
-        debup_print_LabelMap(map->next);
-    }
+// the number of newlines in text
+int countLines(char* text, int len) {
+    int n = 0;
+    for (int i = 0; i < len; i++) n += text[i] == '\n';
+    return n;
 }
 
-LabelMap* count(char* buf, int* len, int* err) {
+void expand(Expander* ex, char* text, int len, Expansion* ctx, int depth, int* err);
+
+// parses the arguments of a call, starting just after its '('. returns how much was consumed, including the ')'
+int parseArgs(char* text, int len, Expansion* call, Expansion* ctx, int* err) {
     int i = 0;
-    int c = 0;
-    LabelMap* map = NULL;
-    for (;;) {
-        while (isspace(buf[i])) {
-            i++;
-        }
-        if (buf[i] == 0) {
-            *len = c;
-            return map;
+    int level = 0;
+    int start = 0;
+    call->nargs = 0;
+    for (;; i++) {
+        if (i == len) {
+            *err = BAD;
+            toolPrintf("FATAL: UNTERMINATED ARGUMENTS TO MACRO \"%s\".\n", call->macro->name);
+            return i;
         }
-        if (buf[i] == '"') {
-            i++;
-            for (;;) {
-                if (buf[i] == 0) {
-                    *err = BAD;
-                    printf("FATAL: ILLEGAL EOF IN STR LITERAL.\n");
-                    return 0;
-                }
-                if (buf[i] == '\\') {
-                    i += 2;
-                    c++;
-                } else if (buf[i] == '"') {
-                    i++;
-                    break;
-                } else {
-                    i++;
-                    c++;
-                }
+        if (text[i] == '(') {
+            level++;
+        } else if (text[i] == ')' && level > 0) {
+            level--;
+        } else if ((text[i] == ',' || text[i] == ')') && level == 0) {
+            int s = start;
+            int e = i;
+            while (s < e && isspace(text[s])) s++;
+            while (e > s && isspace(text[e - 1])) e--;
+            if (text[i] == ')' && call->nargs == 0 && s == e) {
+                return i + 1;   // no arguments at all
             }
-        } else if (buf[i] == '#') {
-            for (;buf[i] != '\n';i++) continue;
-        } else if (buf[i] == '.') {
-            const int istart = i+1;
-            while (buf[i] != '\n' && !isspace(buf[i])) {
-                if (buf[i] == 0) {
-                    *err = BAD;
-                    printf("FATAL: ILLEGAL EOF IN LABEL.\n");
-                    return 0;
-                }
-                i++;
-            }
-            int len = i - istart;
-            if (len > 255) {
+            if (call->nargs == MACRO_ARGS) {
                 *err = BAD;
-                printf("FATAL: LABEL TOO LONG.\n");
-                return 0;
+                toolPrintf("FATAL: TOO MANY ARGUMENTS TO MACRO \"%s\".\n", call->macro->name);
+                return i;
             }
-            map = allocLabel(buf + istart, len, c, map);
-        } else {
-            c += 4;
-            while (buf[i] != '\n') {
-                if (buf[i] == 0) {
-                    *len = c;
-                    return map;
-                }
-                i++;
+            call->args[call->nargs++] = (Arg){text + s, e - s, ctx};
+            start = i + 1;
+            if (text[i] == ')') {
+                return i + 1;
             }
         }
     }
 }
 
-void delabel(char* in, char* out, LabelMap* labels, int* err) {
+void expand(Expander* ex, char* text, int len, Expansion* ctx, int depth, int* err) {
     int i = 0;
-    int c = 0;
-    if (in[i] == '.') {
-        for (;in[i] != '\n' && !isspace(in[i]);i++) continue;
-    } else if (in[i] == '#') {
-        for (;in[i] != '\n';i++) continue;
-    }
-    for (;;) {
-        if (in[i] == 0) {
-            out[c] = 0;
-            return;
-        } else if (in[i] == '\n') {
-            i++;
-            out[c] = '\n';
-            c++;
-            if (in[i] == '.') {
-                for (;in[i] != '\n' && !isspace(in[i]);i++) continue;
-            } else if (in[i] == '#') {
-                for (;in[i] != '\n';i++) continue;
+    while (i < len && *err == OK) {
+        if (ctx == NULL && text[i] == '#' && (i == 0 || text[i-1] == '\n')) {
+            // comments and definitions at the top level, keeping their newline
+            while (i < len && text[i] != '\n') i++;
+            if (i < len) {
+                bufPutc(ex->out, '\n');
+                endLine(ex, depth);
+                i++;
+            }
+        } else if (ctx != NULL && text[i] == '$' && i + 1 < len && text[i+1] >= '1' && text[i+1] <= '9') {
+            int n = text[i+1] - '1';
+            if (n >= ctx->nargs) {
+                *err = BAD;
+                toolPrintf("FATAL: MACRO \"%s\" USES $%i BUT WAS GIVEN %i ARGUMENTS.\n", ctx->macro->name, n + 1, ctx->nargs);
+                return;
             }
-        } else if (in[i] == '.') {
-            char label[256];
-            int label_len = 0;
+            Arg* arg = &ctx->args[n];
+            expand(ex, arg->text, arg->len, arg->ctx, depth, err);
+            i += 2;
+        } else if (ctx != NULL && text[i] == '$' && i + 1 < len && text[i+1] == '@') {
+            char id[16];
+            bufPut(ex->out, id, sprintf(id, "~%i", ctx->id));
+            i += 2;
+        } else if (text[i] == '@') {
             i++;
-            while(in[i] != '\n' && !isspace(in[i])) {
-                label[label_len] = in[i];
-                label_len++;
-                i++;
+            int mpos = i;
+            while (i < len && !isspace(text[i]) && text[i] != '(' && text[i] != ')' && text[i] != ',') i++;
+            Sym* sym = lookup(ex->syms, text + mpos, i - mpos);
+            if (sym == NULL || sym->defn == NULL) {
+                *err = BAD;
+                toolPrintf("UNDEFINED MACRO \"%.*s\"\n", i - mpos, text + mpos);
+                return;
             }
-            label[label_len] = 0;
-            int pos = indexLabel(label, labels, err);
-            if (*err != OK) {
-                printf("FATAL: LABEL \"%s\" NOT FOUND.\n", label);
+            if (depth == MACRO_DEPTH) {
+                *err = BAD;
+                toolPrintf("FATAL: MACROS NESTED DEEPER THAN %i, EXPANDING \"%s\".\n", MACRO_DEPTH, sym->name);
                 return;
             }
-            char posstr[13];
-            sprintf(posstr, "d%i", pos);
-            for (int posstr_i = 0; posstr[posstr_i] != 0; posstr_i++) {
-                out[c] = posstr[posstr_i];
-                c++;
+            Expansion call;
+            call.macro = sym;
+            call.nargs = 0;
+            int argpos = i;
+            if (i < len && text[i] == '(') {
+                i++;
+                i += parseArgs(text + i, len - i, &call, ctx, err);
+                if (*err != OK) return;
             }
+            call.id = ex->expansions++;
+            expand(ex, sym->defn, strlen(sym->defn), &call, depth + 1, err);
+            if (depth == 0) ex->spanned += countLines(text + argpos, i - argpos);
         } else {
-            out[c] = in[i];
-            i++;
-            c++;
+            int start = i;
+            // text up to the next expansion or the end of the line, so that each newline ends a line of its own
+            if (text[i++] != '\n') {
+                while (i < len && text[i] != '@' && text[i] != '$' && text[i] != '\n') i++;
+                if (i < len && text[i] == '\n') i++;
+            }
+            bufPut(ex->out, text + start, i - start);
+            if (text[i - 1] == '\n') {
+                endLine(ex, depth);
+            }
         }
     }
 }
 
-void preprocess(FILE* in, FILE* out, int* err) {
-    fseek(in, 0, SEEK_END);
-    long fsize = ftell(in);
-    fseek(in, 0, SEEK_SET);
-    char* mbuf = calloc(1, fsize + 1);
-    fread(mbuf, 1, fsize, in);
-    fclose(in);
-    mbuf[fsize] = 0;
+// expands ibuf into out, leaving the source line of each line of out in lines
+void demacro(char* ibuf, Buf* out, Buf* lines, SymTab* syms, int* err) {
+    *err = OK;
+    Expander ex = {syms, out, 0, lines, 1, 0};
+    expand(&ex, ibuf, strlen(ibuf), NULL, 0, err);
+    endLine(&ex, 0);    // the last line, which has no newline
+}
 
-    MacroMap* macs = macros(mbuf, err);
+// expands the macros of NUL-terminated source, and turns it into a program
+void preprocess(char* src, SymTab* syms, Program* prog, int* err) {
+    macros(src, syms, err);
     if (*err != OK) {
-        printf("FATAL ERROR while counting macros\n");
+        toolPrintf("FATAL ERROR while counting macros\n");
         return;
     }
 
-    if (macs != NULL) {
-        printf("MACROS DETECTED:\n");
-        debug_print_MacroMap(macs);
-    }
-    FILE* tmp = fopen("tmp.dmasm", "w+");
-    demacro(mbuf, tmp, macs, err);
+    Buf ibuf = {syms->arena, NULL, 0, 0};
+    Buf lines = {syms->arena, NULL, 0, 0};
+    bufPut(&ibuf, "", 0);
+    demacro(src, &ibuf, &lines, syms, err);
     if (*err != OK) {
-        printf("FATAL ERROR while replacing macros\n");
+        toolPrintf("FATAL ERROR while replacing macros\n");
         return;
     }
-    fclose(tmp);
-
-    tmp = fopen("tmp.dmasm", "r");
-    fseek(tmp, 0, SEEK_END);
-    fsize = ftell(tmp);
-    fseek(tmp, 0, SEEK_SET);
-    char* ibuf = calloc(1, fsize + 1);
-    fread(ibuf, 1, fsize, tmp);
-    fclose(tmp);
-    ibuf[fsize] = 0;
-
-    char* obuf = calloc(1, fsize + 1);
 
-    int len = 0;
-
-    LabelMap* map = count(ibuf, &len, err);
+    tokenize(ibuf.data, (int*)lines.data, prog, syms, err);
     if (*err != OK) {
-        return;
-    }
-    printf("OUTPUT FILE SIZE (bytes): %i\n", len);
-    if (map != NULL) {
-        printf("LABELS DETECTED:\n");
-        debup_print_LabelMap(map);
-    }
-    delabel(ibuf, obuf, map, err);
-
-    for (int i = 0; obuf[i] != 0; i++) putc(obuf[i], out);
-    fclose(out);
-}
-/*
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("not enough arguments");
-        return -1;
-    }
-
-    if (argv[1][0] == '-' && argv[1][1] == 'o') {
-        if (argc < 4) {
-            printf("not enough arguments");
-            return -1;
-        }
-
-        FILE* i = fopen(argv[3], "r");
-        FILE* o = fopen(argv[2], "w");
-        int error = OK;
-        demacro(i, o, &error);
-        if (error != OK) {
-            printf("errored during compilation with code %i", error);
-            return 1;
-        }
-        return 0;
-    } else {
-        printf("unrecognised command %s", argv[1]);
-        return 2;
+        toolPrintf("FATAL ERROR while parsing\n");
     }
 }
-*/
\ No newline at end of file
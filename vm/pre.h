@@ -2,5 +2,9 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include "sym.h"
+#include "buf.h"
+#include "lex.h"
 
-void preprocess(FILE* in, FILE* out, int* err);
\ No newline at end of file
+void preprocess(char* src, SymTab* syms, Program* prog, int* err);
+void debug_print_Syms(SymTab* syms);
\ No newline at end of file
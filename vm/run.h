@@ -0,0 +1,157 @@
+/* VM INTERPRETER CORE */
+// included by vm.c once for each variant of run(), named by VARIANT, see INTERPRETER VARIANTS there.
+// INSTRUMENTED is 1 for the variant which profiles and traces, and 0 otherwise
+
+int VARIANT(CPU* cpu, int* boundaries) {
+    VM* vm = cpu->vm;
+    char* mem = vm->mem;
+    uint8_t* vblock = vm->vblock;
+    uint16_t pc = cpu->pc;
+    uint16_t ctl = cpu->ctl;
+    uint8_t op;
+    uint8_t* reg8 = cpu->reg8;
+    uint16_t* reg16 = cpu->reg16;
+    uint32_t* reg32 = cpu->reg32;
+    uint8_t ins[4];     // the instruction being run, expanded if it is 16-bit, see compress.c
+    int left = 0;       // slots left in the verified block being run
+    int trusted = 0;    // whether the instruction being run is verified, see verify.c
+    int paired = 1;     // the second half of a verified slot, once its first half has run and carried on
+    uint8_t proc = mem[ctl];    // the process being run, with its segments and offset, which are only looked up again once it changes
+    uint32_t procLegality = LEGALITY(proc);
+    uint16_t procOffset = OFFSET(proc);
+    int boot = proc == 0 && procLegality == BOOT_LEGALITY;  // whether verified blocks may be run
+    int switched = 0;   // whether the process, or its entry in the PPT, has changed
+    uint8_t prc = proc;
+    (void)procLegality; (void)procOffset; (void)prc;
+    do {
+        if (left == 0 && ++*boundaries == WATCH_PERIOD) {
+            *boundaries = 0;
+            watchdog(cpu);
+        }
+        if (pc % 4 != 0) {
+            trusted = pc == paired;
+            if (!trusted && !READABLE(pc)) {
+                printf("FATAL: INSTRUCTION OVERFLOW\n");
+                vm->status = EXIT_FAULT;
+                cpu->pc = pc;
+                return RUN_STOPPED;
+            }
+        } else if (left != 0) {
+            left--;
+            trusted = 1;
+        } else if (vblock[pc / 4] != 0 && boot) {
+            left = (vblock[pc / 4] & VERIFIED_LEN) - 1;
+            trusted = 1;
+        } else if (READABLE(pc)) {
+            trusted = 0;
+        } else {
+            printf("FATAL: INSTRUCTION OVERFLOW\n");
+            vm->status = EXIT_FAULT;
+            cpu->pc = pc;
+            return RUN_STOPPED;
+        }
+        op = mem[pc];
+        cpu->retired[proc & (MAX_PROC - 1)]++;
+        paired = 1;
+        #if INSTRUMENTED
+        if (cpu->profile != NULL) {
+            profileStep(cpu->profile, pc, op);
+        }
+        if (vm->trace != NULL) {
+            fprintf(vm->trace, "%i:\n", pc);
+        }
+        if (trusted && pc % 4 == 0 && cpu->profile == NULL && vm->aot != NULL
+        #else
+        if (trusted && pc % 4 == 0 && vm->aot != NULL
+        #endif
+                && vm->aot->lens[pc / 4] != 0 && (vblock[pc / 4] & VERIFIED_LEN) >= vm->aot->lens[pc / 4]) {
+            op = TRANSLATED;
+        } else if (op & COMPRESSED) {
+            EXPAND(mem + pc, ins)
+            op = ins[0];
+            if (trusted && pc % 4 == 0 && continuesBlock(op)) {
+                paired = pc + 2;
+            }
+            trusted = 0;    // the verified target of a branch is only kept for 32-bit branches
+            pc -= 2;        // offsets are relative to the end of the instruction, as for the 32-bit one at pc - 2
+        } else {
+            uint32_t word = LOAD(pc, 4, uint32_t);
+            memcpy(ins, &word, 4);
+            #if INSTRUMENTED
+            if (trusted && cpu->profile == NULL && vm->fused[pc / 4] != 0) {
+            #else
+            if (trusted && vm->fused[pc / 4] != 0) {
+            #endif
+                op = vm->fused[pc / 4];
+            }
+        }
+
+        switch (op)
+        {
+        case LIM: DO_LIM(ins[1], ins[2], ins[3]) break;
+        case LD8: DO_LD8(ins[1], ins[2], ins[3]) break;
+        case LD16: DO_LD16(ins[1], ins[2], ins[3]) break;
+        case LD32: DO_LD32(ins[1], ins[2], ins[3]) break;
+        case SV8: DO_SV8(ins[1], ins[2], ins[3]) break;
+        case SV16: DO_SV16(ins[1], ins[2], ins[3]) break;
+        case SV32: DO_SV32(ins[1], ins[2], ins[3]) break;
+        case AND: DO_AND(ins[1], ins[2], ins[3]) break;
+        case OR: DO_OR(ins[1], ins[2], ins[3]) break;
+        case XOR: DO_XOR(ins[1], ins[2], ins[3]) break;
+        case NOR: DO_NOR(ins[1], ins[2], ins[3]) break;
+        case ADD: DO_ADD(ins[1], ins[2], ins[3]) break;
+        case ADDC: DO_ADDC(ins[1], ins[2], ins[3]) break;
+        case SHIFTL: DO_SHIFTL(ins[1], ins[2], ins[3]) break;
+        case SHIFTR: DO_SHIFTR(ins[1], ins[2], ins[3]) break;
+        case LJAL: DO_LJAL(ins[1], ins[2], ins[3]) break;
+        case BEQ: DO_BEQ(ins[1], ins[2], ins[3]) break;
+        case BNE: DO_BNE(ins[1], ins[2], ins[3]) break;
+        case BLT: DO_BLT(ins[1], ins[2], ins[3]) break;
+        case BGT: DO_BGT(ins[1], ins[2], ins[3]) break;
+        case INT: DO_INT(ins[1], ins[2], ins[3]) break;
+        case CAS: DO_CAS(ins[1], ins[2], ins[3]) break;
+        case FADD: DO_FADD(ins[1], ins[2], ins[3]) break;
+        case IPI: DO_IPI(ins[1], ins[2], ins[3]) break;
+        #include "fused.h"
+        case TRANSLATED:
+            op = vm->aot->blocks[pc / 4](cpu, &pc);
+            left = 0;
+            switched = (uint8_t)mem[ctl] != proc || LEGALITY(proc) != procLegality || OFFSET(proc) != procOffset;
+            break;
+        default: break;
+        }
+        pc += 4;
+
+        /* IO */
+
+        #if INSTRUMENTED
+        if (vm->trace != NULL) {
+            fprintf(vm->trace, "stack: ptr: %i, top: %i\n", reg16[0], LOAD(reg16[0], 2, uint16_t));
+        }
+        #endif
+
+        // mem[1022] is the write flag
+        IO_CHECKS
+
+        // interrupts wait until the OS has returned to a user process
+        uint32_t irqs = __atomic_load_n(&cpu->irqs, __ATOMIC_RELAXED);
+        if (irqs != 0) {
+            if (irqs >> STOP_INT) {
+                cpu->pc = pc;
+                return RUN_STOPPED;
+            }
+            if (mem[ctl] != 0) {
+                pc = takeInt(cpu, pc);
+                left = 0;
+                switched = 1;
+            }
+        }
+
+        if (switched) {
+            cpu->pc = pc;
+            return op == HLT ? RUN_STOPPED : RUN_SWITCHED;
+        }
+    } while (op != HLT);
+    cpu->pc = pc;
+    return RUN_STOPPED;
+}
@@ -0,0 +1,190 @@
+/* VM SNAPSHOTS */
+#include "snap.h"
+#include "verify.h"
+#include "watch.h"
+#include <stdlib.h>
+
+enum {
+    OK,
+    BAD
+};
+
+/*
+SNAPSHOTS
+A snapshot holds all 64KB of memory along with the pc, registers and pending interrupts of every cpu.
+Once one is taken, it becomes the 'base': every store marks the 256-byte pages it writes to as dirty,
+so that later states can be stored as a delta of just the dirty pages (see DELTAS below), and the VM can be reset to the base
+by restoring just those pages.
+
+The page holding the PPT and the VM's registers is always treated as dirty, as the VM writes to it itself.
+Channel queues (see chn.c) aren't part of a snapshot.
+
+The OS takes the base snapshot by writing a non-zero byte to SNAP; the VM clears it.
+It may only do so from cpu 0, while every other cpu is parked: a running cpu's pc is only known once it stops,
+and its stores would tear the copy of memory. A write to SNAP at any other time is fatal, and stops the machine.
+With -j N, the VM runs N jobs: the first boots the image, and each one after it is reset to the base snapshot,
+and so resumes just after the write to SNAP, with the number of the job in the two bytes at SNAP_JOB.
+With -f N, N clones of the VM as it was at the base snapshot (see vmClone) then run their jobs side by side.
+*/
+
+void saveCPUs(VM* vm, CPUState* states) {
+    for (int i = 0; i < vm->ncpus; i++) {
+        states[i].pc = vm->cpus[i].pc;
+        memcpy(states[i].reg32, vm->cpus[i].reg32, sizeof(states[i].reg32));
+        states[i].irqs = vm->cpus[i].irqs;
+    }
+}
+
+void restoreCPUs(VM* vm, CPUState* states) {
+    for (int i = 0; i < vm->ncpus; i++) {
+        vm->cpus[i].pc = states[i].pc;
+        memcpy(vm->cpus[i].reg32, states[i].reg32, sizeof(states[i].reg32));
+        vm->cpus[i].irqs = states[i].irqs;
+    }
+}
+
+void takeSnapshot(VM* vm, Snapshot* snap) {
+    memcpy(snap->mem, vm->mem, sizeof(snap->mem));
+    saveCPUs(vm, snap->cpus);
+}
+
+void takeBase(VM* vm) {
+    if (vm->base == NULL) {
+        vm->base = malloc(sizeof(Snapshot));
+    }
+    takeSnapshot(vm, vm->base);
+    memset(vm->dirty, 0, sizeof(vm->dirty));
+}
+
+// takes the base snapshot once the OS has written to SNAP, see above
+void snapRequested(CPU* cpu) {
+    VM* vm = cpu->vm;
+    pthread_mutex_lock(&vm->lock);
+    int running = cpu->id != 0;
+    for (int i = 1; i < vm->ncpus; i++) {
+        running |= vm->cpus[i].awake;
+    }
+    if (!running) {
+        takeBase(vm);
+    }
+    pthread_mutex_unlock(&vm->lock);
+    if (running) {
+        printf("FATAL: SNAPSHOT TAKEN WHILE OTHER CPUS WERE RUNNING\n");
+        vm->status = EXIT_FAULT;
+        for (int i = 0; i < vm->ncpus; i++) {
+            raiseInt(vm, i, STOP_INT);
+        }
+    }
+}
+
+void takeDelta(VM* vm, Delta* delta) {
+    vm->dirty[PPT / PAGE_SIZE] = 1;
+    delta->npages = 0;
+    for (int p = 0; p < NPAGES; p++) {
+        if (!vm->dirty[p]) continue;
+        delta->page[delta->npages] = p;
+        memcpy(delta->data[delta->npages], vm->mem + p * PAGE_SIZE, PAGE_SIZE);
+        delta->npages++;
+    }
+    saveCPUs(vm, delta->cpus);
+    // cpus stopped with the run carry on once the delta is applied
+    for (int i = 0; i < vm->ncpus; i++) {
+        delta->cpus[i].irqs &= ~(1u << STOP_INT);
+    }
+}
+
+void resetToBase(VM* vm) {
+    int code = 0;
+    vm->dirty[PPT / PAGE_SIZE] = 1;
+    for (int p = 0; p < NPAGES; p++) {
+        if (!vm->dirty[p]) continue;
+        memcpy(vm->mem + p * PAGE_SIZE, vm->base->mem + p * PAGE_SIZE, PAGE_SIZE);
+        code |= p * PAGE_SIZE < vm->vend;
+        vm->dirty[p] = 0;
+    }
+    restoreCPUs(vm, vm->base->cpus);
+    vm->frozen = 0;
+    // stores over the image unverified it
+    if (code) {
+        verify(vm, vm->vend);
+    }
+}
+
+void applyDelta(VM* vm, Delta* delta) {
+    resetToBase(vm);
+    for (int i = 0; i < delta->npages; i++) {
+        memcpy(vm->mem + delta->page[i] * PAGE_SIZE, delta->data[i], PAGE_SIZE);
+        vm->dirty[delta->page[i]] = 1;
+    }
+    restoreCPUs(vm, delta->cpus);
+    verify(vm, vm->vend);
+}
+
+/*
+DELTAS
+With -d file, once its jobs are done the VM's state is written to file as a delta against the base snapshot:
+just the pages written to since the base was taken, along with the state of every cpu.
+With -i file, the jobs after the first, and the clones of -f, start from the base with that delta applied
+rather than from the base itself, so that the jobs of one run can carry on from where those of another stopped,
+after the hlt that ended them. The image must be the same, and take its base at the same point, in both runs.
+The file starts with a header, then holds the number of pages, then their numbers, then their contents,
+then the cpus, as they are in memory. The header holds DELTA_MAGIC, which reads back reversed on a host
+of the other endianness, DELTA_VERSION, and the sizes the rest was written with, so that a delta written
+by another build of the VM, or on another host, is refused rather than loaded over memory.
+*/
+
+#define DELTA_MAGIC 0x544c4452u     // "RDLT" as written on a little-endian host
+#define DELTA_VERSION 1             // changes whenever the format of a delta does
+
+void deltaHeader(uint32_t* header) {
+    header[0] = DELTA_MAGIC;
+    header[1] = DELTA_VERSION;
+    header[2] = PAGE_SIZE;
+    header[3] = MAX_CPU;
+    header[4] = sizeof(CPUState);
+}
+
+int saveDelta(VM* vm, char* path) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        return BAD;
+    }
+    Delta* delta = malloc(sizeof(Delta));
+    takeDelta(vm, delta);
+    uint32_t header[5];
+    deltaHeader(header);
+    uint32_t n = delta->npages;
+    int ok = fwrite(header, sizeof(header), 1, f) == 1
+        && fwrite(&n, sizeof(n), 1, f) == 1
+        && fwrite(delta->page, 1, n, f) == n
+        && fwrite(delta->data, PAGE_SIZE, n, f) == n
+        && fwrite(delta->cpus, sizeof(CPUState), MAX_CPU, f) == MAX_CPU;
+    ok &= fclose(f) == 0;
+    free(delta);
+    return ok ? OK : BAD;
+}
+
+Delta* loadDelta(char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return NULL;
+    }
+    Delta* delta = malloc(sizeof(Delta));
+    uint32_t expected[5];
+    uint32_t header[5];
+    deltaHeader(expected);
+    uint32_t n = 0;
+    int ok = fread(header, sizeof(header), 1, f) == 1 && memcmp(header, expected, sizeof(header)) == 0
+        && fread(&n, sizeof(n), 1, f) == 1 && n <= NPAGES
+        && fread(delta->page, 1, n, f) == n
+        && fread(delta->data, PAGE_SIZE, n, f) == n
+        && fread(delta->cpus, sizeof(CPUState), MAX_CPU, f) == MAX_CPU
+        && fgetc(f) == EOF;
+    fclose(f);
+    if (!ok) {
+        free(delta);
+        return NULL;
+    }
+    delta->npages = n;
+    return delta;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "vm.h"
+
+// marks the pages written to by a store of len bytes at addr
+#define DIRTY(vm, addr, len) do { \
+    (vm)->dirty[(uint16_t)(addr) / PAGE_SIZE] = 1; \
+    (vm)->dirty[(uint16_t)((addr) + (len) - 1) / PAGE_SIZE] = 1; \
+} while (0)
+
+typedef struct {
+    uint16_t pc;
+    uint32_t reg32[8];
+    uint32_t irqs;
+} CPUState;
+
+typedef struct Snapshot {
+    char mem[65536];
+    CPUState cpus[MAX_CPU];
+} Snapshot;
+
+typedef struct {
+    int npages;
+    uint8_t page[NPAGES];       // numbers of the pages stored, in order
+    char data[NPAGES][PAGE_SIZE];
+    CPUState cpus[MAX_CPU];
+} Delta;
+
+void takeSnapshot(VM* vm, Snapshot* snap);
+void takeBase(VM* vm);
+void snapRequested(CPU* cpu);
+void takeDelta(VM* vm, Delta* delta);
+void resetToBase(VM* vm);
+void applyDelta(VM* vm, Delta* delta);
+int saveDelta(VM* vm, char* path);
+Delta* loadDelta(char* path);
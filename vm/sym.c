@@ -0,0 +1,77 @@
+/* PREPROCESSOR SYMBOL TABLE */
+#include "sym.h"
+
+/*
+SYMBOL TABLE
+Macros and labels share one open-addressing hash table, probed linearly and keyed by name.
+Each name is stored ('interned') once, together with whatever is defined under it,
+so that finding a macro or a label takes a single probe sequence.
+The table doubles in size whenever it is half full.
+Symbols and tables are allocated from the table's arena, and are released along with it.
+*/
+
+uint32_t hashName(const char* name, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+Sym* lookup(SymTab* tab, const char* name, int len) {
+    if (tab->cap == 0) return NULL;
+    uint32_t hash = hashName(name, len);
+    for (uint32_t i = hash & (tab->cap - 1);; i = (i + 1) & (tab->cap - 1)) {
+        Sym* sym = tab->slots[i];
+        if (sym == NULL) {
+            return NULL;
+        }
+        if (sym->hash == hash && sym->len == len && memcmp(sym->name, name, len) == 0) {
+            return sym;
+        }
+    }
+}
+
+void grow(SymTab* tab) {
+    int cap = tab->cap == 0 ? 64 : tab->cap * 2;
+    Sym** slots = arenaZalloc(tab->arena, cap * sizeof(Sym*));
+    for (int i = 0; i < tab->cap; i++) {
+        Sym* sym = tab->slots[i];
+        if (sym == NULL) continue;
+        uint32_t j = sym->hash & (cap - 1);
+        while (slots[j] != NULL) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = sym;
+    }
+    tab->slots = slots;
+    tab->cap = cap;
+}
+
+Sym* intern(SymTab* tab, const char* name, int len) {
+    Sym* sym = lookup(tab, name, len);
+    if (sym != NULL) {
+        return sym;
+    }
+    if ((tab->count + 1) * 2 > tab->cap) {
+        grow(tab);
+    }
+    sym = arenaAlloc(tab->arena, sizeof(Sym) + len + 1);
+    sym->hash = hashName(name, len);
+    sym->len = len;
+    sym->defn = NULL;
+    sym->pos = -1;
+    sym->value = NULL;
+    sym->global = 0;
+    sym->index = -1;
+    memcpy(sym->name, name, len);
+    sym->name[len] = 0;
+
+    uint32_t i = sym->hash & (tab->cap - 1);
+    while (tab->slots[i] != NULL) {
+        i = (i + 1) & (tab->cap - 1);
+    }
+    tab->slots[i] = sym;
+    tab->count++;
+    return sym;
+}
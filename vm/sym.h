@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+typedef struct {
+    uint32_t hash;
+    int len;
+    char* defn;     // macro definition, or NULL
+    int pos;        // label position, or -1
+    struct Expr* value; // constant, or NULL
+    int global;     // exported from its object file, see obj.c
+    int index;      // number of the symbol in an object file, or its module when linking
+    char name[];
+} Sym;
+
+typedef struct {
+    Arena* arena;   // owns the table and every symbol in it
+    Sym** slots;
+    int cap;        // always a power of two
+    int count;
+} SymTab;
+
+Sym* lookup(SymTab* tab, const char* name, int len);
+Sym* intern(SymTab* tab, const char* name, int len);
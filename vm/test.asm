@@ -3,7 +3,7 @@
 lim r8 .printStr
 lim r9 d1125
 s16 r8 r9 d0
-lim r0 .handler-data
+lim r0 .handler_data
 @interrupt
 
 .printStr
@@ -20,5 +20,5 @@ s08 r6 r2 d0
 adc r0 r1 r0
 bne r3 r1 d-24
 
-.handler-data
+.handler_data
 "multiple of four chars long\0"
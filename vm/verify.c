@@ -0,0 +1,156 @@
+/* VM LOAD-TIME VERIFIER */
+#include "verify.h"
+#include "fuse.h"
+#include "compress.h"
+#include <stdlib.h>
+
+/*
+VERIFICATION
+When an image is loaded, the control flow graph of the boot process is built from its decoded instructions,
+starting at address 0 and following fallthroughs and static branches.
+LJAL targets are only known at run time, so every address in the image loaded by LIM, and every return address LJAL links, is a start as well;
+checking an address which turns out not to be a target costs nothing more than the check.
+Every instruction reached is checked to be fetchable by process 0 under BOOT_LEGALITY, and every static branch target is checked the same way.
+
+The result is kept in vblock, one byte per 4-byte instruction slot:
+the low bits count the verified slots from that slot to the end of its block, and the high bit marks a branch whose target is verified.
+Blocks end at branches, jumps, interrupts and anything which writes memory, since a store could change the current process or the PPT.
+
+While running, a cpu entering a verified block checks once that it is in process 0 with the legality the block was verified under,
+and then runs the rest of the block, and its branch, without checking fetches or branch targets.
+Anything that isn't verified is checked as before.
+Storing over a verified instruction unverifies it.
+
+A slot may instead hold two 16-bit instructions (see compress.c), which are verified together, as one step of a block:
+the slot only continues its block if both of them do. The second is only run as verified straight after the first,
+and 16-bit branches always check their targets, so a slot keeps at most one verified target.
+A slot holding a 16-bit instruction and half of a 32-bit one is never verified.
+*/
+
+int isFetchable(uint16_t addr) {
+    return ((BOOT_LEGALITY >> 31) | (BOOT_LEGALITY >> (addr / SEG_SIZE))) & 1;
+}
+
+int isBranch(uint8_t op) {
+    return op == BEQ || op == BNE || op == BLT || op == BGT;
+}
+
+// whether control may pass on to the next instruction inside the same block
+int continuesBlock(uint8_t op) {
+    switch (op)
+    {
+    case LIM:
+    case LD8:
+    case LD16:
+    case LD32:
+    case AND:
+    case OR:
+    case XOR:
+    case NOR:
+    case ADD:
+    case ADDC:
+    case SHIFTL:
+    case SHIFTR:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+// the instructions in a slot, expanding a pair of 16-bit ones. returns how many there are, or 0 if the slot can't be verified
+int decodeSlot(char* code, uint8_t ins[2][4]) {
+    if (!((uint8_t)code[0] & COMPRESSED)) {
+        memcpy(ins[0], code, 4);
+        return ins[0][0] > IPI ? 0 : 1;
+    }
+    if (!((uint8_t)code[2] & COMPRESSED)) return 0;
+    EXPAND(code, ins[0])
+    EXPAND(code + 2, ins[1])
+    return ins[0][0] > IPI || ins[1][0] > IPI ? 0 : 2;
+}
+
+void verify(VM* vm, int size) {
+    char* mem = vm->mem;
+    uint8_t* vblock = vm->vblock;
+    uint8_t* reached = calloc(65536 / 4, 1);
+    uint16_t* work = malloc(65536 / 2 * sizeof(uint16_t));
+    int nwork = 0;
+
+    memset(vblock, 0, sizeof(vm->vblock));
+    vm->vend = size;
+
+    work[nwork++] = 0;
+    while (nwork != 0) {
+        uint16_t addr = work[--nwork];
+        for (;;) {
+            if (addr % 4 != 0 || addr + 4 > size || reached[addr / 4] || !isFetchable(addr)) break;
+            uint8_t ins[2][4];
+            int n = decodeSlot(mem + addr, ins);
+            if (n == 0) break;
+            reached[addr / 4] = 1;
+
+            uint8_t op = 0;
+            for (int k = 0; k < n; k++) {
+                op = ins[k][0];
+                uint16_t next = n == 1 ? addr + 4 : addr + 2*k + 2;     // offsets are relative to here
+                if (op == LIM) {
+                    uint16_t target = ins[k][2] | ins[k][3] << 8;
+                    if (target % 4 == 0 && target < size) {
+                        work[nwork++] = target;
+                    }
+                } else if (op == LJAL) {
+                    work[nwork++] = next + (int8_t)ins[k][3];
+                } else if (isBranch(op)) {
+                    uint16_t newpos = next - 4 + (int8_t)ins[k][3];
+                    if (isFetchable(newpos)) {
+                        work[nwork++] = newpos + 4;
+                    }
+                }
+            }
+            if (op == HLT || op == LJAL) break;
+            addr += 4;
+        }
+    }
+
+    // lengths are counted back from the end of each block
+    for (int slot = size / 4 - 1; slot >= 0; slot--) {
+        if (!reached[slot]) continue;
+        uint8_t ins[2][4];
+        int n = decodeSlot(mem + slot * 4, ins);
+        int continues = continuesBlock(ins[0][0]) && (n == 1 || continuesBlock(ins[1][0]));
+        int len = 1;
+        if (continues && slot + 1 < size / 4 && reached[slot + 1]) {
+            len += vblock[slot + 1] & VERIFIED_LEN;
+        }
+        vblock[slot] = len > VERIFIED_LEN ? VERIFIED_LEN : len;
+    }
+
+    for (int slot = 0; slot < size / 4; slot++) {
+        uint8_t op = mem[slot * 4];
+        if (!reached[slot] || !isBranch(op)) continue;
+        uint16_t newpos = slot * 4 + (int8_t)mem[slot * 4 + 3];
+        if (isFetchable(newpos) && newpos % 4 == 0 && vblock[(uint16_t)(newpos + 4) / 4] != 0) {
+            vblock[slot] |= VERIFIED_TARGET;
+        }
+    }
+    free(reached);
+    free(work);
+    predecode(vm);
+}
+
+void unverify(VM* vm, uint16_t addr, int len) {
+    uint8_t* vblock = vm->vblock;
+    int vend = vm->vend;
+    if (addr >= vend || len == 0) return;
+    int first = addr / 4;
+    int last = (addr + len - 1 < vend ? addr + len - 1 : vend - 1) / 4;
+    for (int slot = first; slot <= last; slot++) {
+        vblock[slot] = 0;
+    }
+    unfuse(vm, first, last);
+    // instructions before the first one in the same block now end just before it
+    for (int slot = first - 1, n = 1; slot >= 0 && (vblock[slot] & VERIFIED_LEN) > n; slot--, n++) {
+        vblock[slot] = (vblock[slot] & VERIFIED_TARGET) | n;
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "vm.h"
+
+#define VERIFIED_LEN 127        // low bits of vblock: verified slots from here to the end of the block
+#define VERIFIED_TARGET 128     // high bit of vblock: the branch here has a verified target
+
+int continuesBlock(uint8_t op);
+int decodeSlot(char* code, uint8_t ins[2][4]);
+void verify(VM* vm, int size);
+void unverify(VM* vm, uint16_t addr, int len);
@@ -1,42 +1,54 @@
-#include <stdint.h>
-#include <stdio.h>
-
-//#define DEBUG
-
-#define SEG_SIZE 2048
-
-#define READONLY_SIZE 32
-#define READONLY SEG_SIZE - READONLY_SIZE
-
-#define PPT 1024
-#define MAX_PROC 16
-
-#define PRC PPT + 6*MAX_PROC    // one byte for the current process
-#define INT_PRC PRC + 1         // one byte for the return process
-#define INT_RET INT_PRC + 1     // two bytes for the return address
-#define INT_REQ INT_RET + 2     // one byte for the requested interrupt code
-#define INT_HAND INT_REQ + 1    // two byte pointer to the interrupt handler
-
-char mem[65536];
-
-#define INT(code, offset) \
-*(uint16_t*)(mem + INT_RET) = pc + offset; \
-mem[INT_PRC] = mem[PRC]; \
-mem[PRC] = 0; \
-pc = *(uint16_t*)(mem + INT_HAND);
-
-#define OFFSET(prc) *(uint16_t*)(mem + PPT + 6*prc)
-
-#define MEMEXCEPT INT(0, 4)
-
-int isReadable(uint16_t addr, uint8_t prc) {
+#define _GNU_SOURCE
+#include "vm.h"
+#include "chn.h"
+#include "verify.h"
+#include "snap.h"
+#include "cache.h"
+#include "fuse.h"
+#include "ins.h"
+#include "aot.h"
+#include "compress.h"
+#include "watch.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+int isReadable(VM* vm, uint16_t addr, uint8_t prc) {
+    char* mem = vm->mem;
     uint32_t legality = *(uint32_t*)(mem + PPT + 2 + 6*prc);
     return (((legality >> 31) | (legality >> (addr / SEG_SIZE))) & 1);
 }
 
-int isWriteable(uint16_t unaddr, uint16_t addr, uint8_t prc) {
+int isWriteable(VM* vm, uint16_t unaddr, uint16_t addr, int len, uint8_t prc) {
+    char* mem = vm->mem;
     uint32_t legality = *(uint32_t*)(mem + PPT + 2 + 6*prc);
-    return ((legality >> 31) | ((legality >> (addr / SEG_SIZE)) & (unaddr < READONLY)) & 1);
+    return ((legality >> 31) | ((legality >> (addr / SEG_SIZE)) & (unaddr < READONLY)) & 1) && !IN_PERF(addr, len);
+}
+
+/*
+WRAPPING
+Memory is exactly 64KB, so a 16- or 32-bit access near its top wraps around to its bottom, as its address would.
+The DO_ macros only come here for those, see LOAD and STORE in ins.h.
+*/
+
+uint32_t loadWrapped(char* mem, uint16_t addr, int len) {
+    uint32_t value = 0;
+    for (int i = 0; i < len; i++) {
+        value |= (uint32_t)(uint8_t)mem[(uint16_t)(addr + i)] << 8*i;
+    }
+    return value;
+}
+
+// the bytes at the top are unverified by the caller, and those which wrap around here
+void storeWrapped(VM* vm, uint16_t addr, int len, uint32_t value) {
+    for (int i = 0; i < len; i++) {
+        vm->mem[(uint16_t)(addr + i)] = value >> 8*i;
+    }
+    int wrapped = addr + len - 65536;
+    if (wrapped > 0) {
+        unverify(vm, 0, wrapped);
+    }
 }
 
 /*
@@ -62,420 +74,497 @@ sg = segment allowed bit
 for a total of 6 bytes per process, or 16 * 6 = 96 bytes overall
 
 the current process is stored as a byte at address 1120, and so can only be managed by the OS.
+the registers of the message channel device follow the interrupt registers, see chn.c.
 
 calling OS processes is done with the INT instruction, in the form:
 INT code offset
 
 */
 
-enum INS {
-    HLT,
+/*
+MULTIPROCESSING
+Up to 8 cpus run over the same memory, each on its own host thread, with its own registers, pc and control block (see vm.h).
+cpu 0 starts at address 0, while the others are 'parked' until they are sent an interrupt with IPI, which they take straight away.
+A cpu other than 0 which halts is parked again, and once cpu 0 halts the whole machine stops.
+The number of cpus is stored as a byte at SMP_CPUS.
+
+IPI cpu code
+interrupts another cpu with the given code; only the OS may send interrupts.
+
+CAS and FADD atomically operate on the 16-bit word at the address in their second register:
+CAS old addr new    stores new if the word is equal to old, and loads the previous value of the word into old
+FADD old addr inc   adds inc to the word, and loads its previous value into old
+*/
 
-    LIM,
+/*
+PERFORMANCE COUNTERS
+The VM counts instructions retired (in total and by each process), memory exceptions, interrupts taken and branches taken.
+Counters are kept by each cpu, and are gathered into the 32-bit words at PERF whenever they are loaded from there.
+They all wrap around, and can't be written to.
+*/
 
-    LD8,
-    LD16,
-    LD32,
+void gatherPerf(VM* vm) {
+    uint32_t* perf = (uint32_t*)(vm->mem + PERF);
+    memset(perf, 0, PERF_SIZE);
+    for (int i = 0; i < vm->ncpus; i++) {
+        CPU* cpu = vm->cpus + i;
+        for (int p = 0; p < MAX_PROC; p++) {
+            perf[(PERF_PRC - (PERF))/4 + p] += cpu->retired[p];
+            perf[0] += cpu->retired[p];
+        }
+        perf[(PERF_MEMEXC - (PERF))/4] += cpu->memexcs;
+        perf[(PERF_INTS - (PERF))/4] += cpu->ints;
+        perf[(PERF_BRANCH - (PERF))/4] += cpu->branches;
+    }
+}
 
-    SV8,
-    SV16,
-    SV32,
+// enters the handler for the lowest pending interrupt, to return to pc afterwards
+uint16_t takeInt(CPU* cpu, uint16_t pc) {
+    char* mem = cpu->vm->mem;
+    uint16_t ctl = cpu->ctl;
+    uint8_t code = __builtin_ctz(__atomic_load_n(&cpu->irqs, __ATOMIC_RELAXED));
+    __atomic_and_fetch(&cpu->irqs, ~(1u << code), __ATOMIC_RELAXED);
+    INT(code, 0)
+    return pc + 4;
+}
 
-    AND,
-    OR,
-    XOR,
-    NOR,
+// devices written to through memory, which are checked after every store
+#define IO_CHECKS \
+if (mem[1022] != 0 && __atomic_exchange_n(mem + 1022, 0, __ATOMIC_RELAXED) != 0) { \
+    fputc(mem[1023], stdout); \
+    cpu->written++; \
+} \
+if (mem[CHN_CMD] != 0) { \
+    chnStep(vm); \
+} \
+if (mem[SNAP] != 0) { \
+    mem[SNAP] = 0; \
+    cpu->pc = pc; \
+    snapRequested(cpu); \
+}
 
-    ADD,
-    ADDC,
-    SHIFTL,
-    SHIFTR,
+// runs one instruction of a superinstruction, and moves on to the next if nothing has gotten in the way:
+// an interrupt, or the next instruction no longer being verified. otherwise the rest is run one by one
+#define STEP(o) { \
+    uint32_t ints = cpu->ints; \
+    DO_##o((uint8_t)mem[pc + 1], (uint8_t)mem[pc + 2], (uint8_t)mem[pc + 3]) \
+    if (cpu->ints != ints) break; \
+    pc += 4; \
+    if (WRITES_MEMORY(o)) { \
+        IO_CHECKS \
+    } \
+    if (left != 0) { \
+        left--; \
+    } else if (!switched && vblock[pc / 4] != 0 && boot) { \
+        left = (vblock[pc / 4] & VERIFIED_LEN) - 1; \
+    } else { \
+        pc -= 4; \
+        break; \
+    } \
+    cpu->retired[proc & (MAX_PROC - 1)]++; \
+}
 
-    LJAL,
-    BEQ,
-    BNE,
-    BLT,
-    BGT,
+#define FUSE2(id, a, b) case FUSED + id: STEP(a) DO_##b((uint8_t)mem[pc + 1], (uint8_t)mem[pc + 2], (uint8_t)mem[pc + 3]) break;
+#define FUSE3(id, a, b, c) case FUSED + id: STEP(a) STEP(b) DO_##c((uint8_t)mem[pc + 1], (uint8_t)mem[pc + 2], (uint8_t)mem[pc + 3]) break;
 
-    INT,
+/*
+INTERPRETER VARIANTS
+run() is written once, in run.h, and compiled into a variant for each way the DO_ macros can check and relocate accesses:
+privileged      for a process whose legality has bit 31 set and whose offset is 0, such as the OS,
+                which has nothing to check or relocate, except that the performance counters stay read-only
+user            for any other process, whose segments and offset are kept in locals rather than looked up for every access
+instrumented    for a VM which is being profiled (vm -p) or traced (vm -x), which looks everything up as before
+A variant runs until the process changes, by an interrupt or a store to the PPT or to the cpu's process byte,
+and run() then picks the variant for the process now running.
+A process whose PPT entry is changed by another cpu keeps its old segments until it next changes.
+*/
+
+enum {
+    RUN_STOPPED,    // the cpu halted or was stopped
+    RUN_SWITCHED,   // the process changed
 };
 
-void run() {
-    mem[1120] = 0;
-    *(uint32_t*)(mem + 1026) = 1 << 31;
-    uint16_t pc = 0;
-    uint8_t op;
-    uint8_t reg8[32]; // 32 8-bit registers, 16 16-bit registers, 8 32-bit registers
-    uint16_t* reg16 = reg8;
-    uint32_t* reg32 = reg8;
+// whether a store of len bytes at addr reaches the PPT, or the process byte of the cpu's control block
+#define CONTROL(addr, len) ((uint16_t)((addr) + (len) - 1 - (PPT)) < 6*MAX_PROC + (len) - 1 || (uint16_t)((addr) + (len) - 1 - ctl) < (len))
+
+#undef STORED
+#undef SWITCHED
+#define STORED(addr, len) if (CONTROL(addr, len)) switched = 1;
+#define SWITCHED switched = 1;
+
+#define VARIANT runPrivileged
+#define INSTRUMENTED 0
+#undef CURRENT_PRC
+#undef RELOCATE
+#undef READABLE
+#undef WRITEABLE
+#define CURRENT_PRC proc
+#define RELOCATE(unaddr) (uint16_t)(unaddr)
+#define READABLE(addr) 1
+#define WRITEABLE(unaddr, addr, len) !IN_PERF(addr, len)
+#include "run.h"
+
+#undef VARIANT
+#undef RELOCATE
+#undef READABLE
+#undef WRITEABLE
+#define VARIANT runUser
+#define RELOCATE(unaddr) (uint16_t)(procOffset + (unaddr))
+#define READABLE(addr) (((procLegality >> 31) | (procLegality >> ((addr) / SEG_SIZE))) & 1)
+#define WRITEABLE(unaddr, addr, len) ((((procLegality >> 31) | ((procLegality >> ((addr) / SEG_SIZE)) & ((unaddr) < READONLY))) & 1) \
+    && !IN_PERF(addr, len))
+#include "run.h"
+
+#undef VARIANT
+#undef INSTRUMENTED
+#undef CURRENT_PRC
+#undef RELOCATE
+#undef READABLE
+#undef WRITEABLE
+#undef TRACE
+#define VARIANT runInstrumented
+#define INSTRUMENTED 1
+#define CURRENT_PRC mem[ctl]
+#define RELOCATE(unaddr) (uint16_t)(OFFSET(prc) + (unaddr))
+#define READABLE(addr) isReadable(vm, addr, prc)
+#define WRITEABLE(unaddr, addr, len) isWriteable(vm, unaddr, addr, len, prc)
+#define TRACE(...) { if (vm->trace != NULL) fprintf(vm->trace, __VA_ARGS__); }
+#include "run.h"
+
+void run(CPU* cpu) {
+    VM* vm = cpu->vm;
+    char* mem = vm->mem;
+    int boundaries = 0;     // blocks started since the watchdog was last looked at, see watch.c
+    int status;
     do {
-        if (isReadable(pc, mem[PRC])) {
-            op = mem[pc];
+        uint8_t prc = mem[cpu->ctl];
+        if (cpu->profile != NULL || vm->trace != NULL) {
+            status = runInstrumented(cpu, &boundaries);
+        } else if ((LEGALITY(prc) >> 31) && OFFSET(prc) == 0) {
+            status = runPrivileged(cpu, &boundaries);
         } else {
-            printf("FATAL: INSTRUCTION OVERFLOW\n");
-            return;
-        }
-
-        #ifdef DEBUG
-        printf("%i:\n", pc);
-        #endif
-
-        switch (op)
-        {
-        case LIM: {
-            uint8_t reg = mem[pc + 1];
-            uint16_t val = *(uint16_t*)(mem + pc + 2);
-            reg16[reg] = val;
-            break;
-        }
-        
-        case LD8: {
-            uint8_t reg = mem[pc + 1];
-            uint8_t addrreg = mem[pc + 2];
-            int8_t offset = mem[pc+3];
-
-            uint8_t prc = mem[PRC];
-            uint16_t addr = OFFSET(prc) + offset + reg16[addrreg];
-            if (isReadable(addr, prc)) {
-                #ifdef DEBUG
-                printf("loaded addr %i into 8r%i\n", addr, reg);
-                #endif
-                reg8[reg] = mem[addr];
-            } else {
-                MEMEXCEPT
-            }
-            break;
+            status = runUser(cpu, &boundaries);
         }
+    } while (status == RUN_SWITCHED);
+}
 
-        case LD16: {
-            uint8_t reg = mem[pc + 1];
-            uint8_t addrreg = mem[pc + 2];
-            int8_t offset = mem[pc+3];
-
-            uint8_t prc = mem[PRC];
-            uint16_t addr = OFFSET(prc) + offset + reg16[addrreg];
-            if (isReadable(addr, prc)) {
-                #ifdef DEBUG
-                printf("loaded addr %i into 16r%i\n", addr, reg);
-                #endif
-                reg16[reg] = *(uint16_t*)(mem + addr);
-            } else {
-                MEMEXCEPT
-            }
-            break;
-        }
+void raiseInt(VM* vm, uint8_t cpu, uint8_t code) {
+    pthread_mutex_lock(&vm->lock);
+    __atomic_or_fetch(&vm->cpus[cpu].irqs, 1u << code, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&vm->wake);
+    pthread_mutex_unlock(&vm->lock);
+}
 
-        case LD32: {
-            uint8_t reg = mem[pc + 2];
-            uint8_t addrreg = mem[pc + 1];
-            int8_t offset = mem[pc+3];
-            
-            uint8_t prc = mem[PRC];
-            uint16_t addr = OFFSET(prc) + offset + reg16[addrreg];
-            if (isReadable(addr, prc)) {
-                #ifdef DEBUG
-                printf("loaded addr %i into 16r%i\n", addr, reg);
-                #endif
-                reg32[reg] = *(uint32_t*)(mem + addr);
-            } else {
-                MEMEXCEPT
-            }
-            break;
+void* parked(void* arg) {
+    CPU* cpu = arg;
+    for (;;) {
+        pthread_mutex_lock(&cpu->vm->lock);
+        while (cpu->irqs == 0) {
+            pthread_cond_wait(&cpu->vm->wake, &cpu->vm->lock);
         }
-        
-        case SV8: {
-            uint8_t reg = mem[pc + 1];
-            uint8_t addrreg = mem[pc + 2];
-            int8_t offset = mem[pc+3];
-            
-            uint8_t prc = mem[PRC];
-            uint16_t unaddr = offset + reg16[addrreg];
-            uint16_t addr = OFFSET(prc) + unaddr;
-            if (isWriteable(unaddr, addr, prc)) {
-                #ifdef DEBUG
-                printf("wrote: 8x%i to: %i\n", reg8[reg], addr);
-                #endif
-                mem[addr] = reg8[reg];
-            } else {
-                MEMEXCEPT
-            }
-            break;
+        if (cpu->irqs >> STOP_INT) {
+            pthread_mutex_unlock(&cpu->vm->lock);
+            return NULL;
         }
+        cpu->awake = 1;
+        pthread_mutex_unlock(&cpu->vm->lock);
+        cpu->pc = takeInt(cpu, cpu->pc);
+        run(cpu);
+        pthread_mutex_lock(&cpu->vm->lock);
+        cpu->awake = 0;
+        pthread_mutex_unlock(&cpu->vm->lock);
+    }
+}
 
-        case SV16: {
-            uint8_t reg = mem[pc + 1];
-            uint8_t addrreg = mem[pc + 2];
-            int8_t offset = mem[pc+3];
-            
-            uint8_t prc = mem[PRC];
-            uint16_t unaddr = offset + reg16[addrreg];
-            uint16_t addr = OFFSET(prc) + unaddr;
-            if (isWriteable(unaddr, addr, prc)) {
-                #ifdef DEBUG
-                printf("wrote: 16x%i to: %i\n", reg16[reg], addr);
-                #endif
-                *(uint16_t*)(mem + addr) = reg16[reg];
-            } else {
-                MEMEXCEPT
-            }
-            break;
-        }
+VM* vmNew() {
+    VM* vm = calloc(1, sizeof(VM));
+    vm->mem = mmap(NULL, 65536, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    vm->ncpus = 1;
+    pthread_mutex_init(&vm->lock, NULL);
+    pthread_cond_init(&vm->wake, NULL);
+    pthread_mutex_init(&vm->chnLock, NULL);
+    vm->cowfd = -1;
+    for (int i = 0; i < MAX_CPU; i++) {
+        vm->cpus[i].vm = vm;
+        vm->cpus[i].id = i;
+        vm->cpus[i].ctl = i == 0 ? PRC : SMP_CTL + CTL_SIZE*(i - 1);
+    }
+    return vm;
+}
 
-        case SV32: {
-            uint8_t reg = mem[pc + 1];
-            uint8_t addrreg = mem[pc + 2];
-            int8_t offset = mem[pc+3];
-            
-            uint8_t prc = mem[PRC];
-            uint16_t unaddr = offset + reg16[addrreg];
-            uint16_t addr = OFFSET(prc) + unaddr;
-            if (isWriteable(unaddr, addr, prc)) {
-                #ifdef DEBUG
-                printf("wrote: 32x%i to: %i\n", reg32[reg], addr);
-                #endif
-                *(uint32_t*)(mem + addr) = reg32[reg];
-            } else {
-                MEMEXCEPT
-            }
-            break;
-        }
+/*
+CLONING
+vmClone creates a VM in the same state as its parent, sharing its memory copy-on-write.
+The parent's memory is first 'frozen' into an anonymous file, which the parent and all its clones map privately,
+so that the host only copies a page the first time one of them writes to it.
+The frozen copy is reused for further clones, for as long as the parent isn't run or reset.
+Each clone has its own cpus, verified blocks and dirty pages, but no base snapshot and no channels.
+*/
 
-        case AND: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i & r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] & reg16[srcreg2];
-            break;
+VM* vmClone(VM* parent) {
+    if (!parent->frozen) {
+        int fd = memfd_create("vm", 0);
+        // the parent's memory stays where it is, as the metrics thread may be reading it, see metrics.c
+        if (fd == -1 || write(fd, parent->mem, 65536) != 65536
+                || mmap(parent->mem, 65536, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            printf("FATAL: COULDN'T FREEZE MEMORY FOR CLONING\n");
+            if (fd != -1) {
+                close(fd);
+            }
+            return NULL;
         }
-        
-        case OR: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i | r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] | reg16[srcreg2];
-            break;
+        if (parent->cowfd != -1) {
+            close(parent->cowfd);
         }
+        parent->cowfd = fd;
+        parent->frozen = 1;
+    }
 
-        case XOR: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i ^ r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] ^ reg16[srcreg2];
-            break;
-        }
+    char* mem = mmap(NULL, 65536, PROT_READ | PROT_WRITE, MAP_PRIVATE, parent->cowfd, 0);
+    if (mem == MAP_FAILED) {
+        printf("FATAL: COULDN'T MAP MEMORY FOR CLONING\n");
+        return NULL;
+    }
+    VM* vm = vmNew();
+    munmap(vm->mem, 65536);
+    vm->mem = mem;
+    vm->ncpus = parent->ncpus;
+    for (int i = 0; i < MAX_CPU; i++) {
+        vm->cpus[i] = parent->cpus[i];
+        vm->cpus[i].vm = vm;
+        vm->cpus[i].profile = NULL;
+    }
+    memcpy(vm->vblock, parent->vblock, sizeof(vm->vblock));
+    memcpy(vm->fused, parent->fused, sizeof(vm->fused));
+    vm->aot = parent->aot;
+    vm->vend = parent->vend;
+    vm->budget = parent->budget;
+    vm->timeout = parent->timeout;
+    vm->cancelled = parent->cancelled;  // a cancel still pending applies to the clones' runs too
+    return vm;
+}
 
-        case NOR: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("~(r%i | r%i) -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = ~(reg16[srcreg1] | reg16[srcreg2]);
-            break;
-        }
+void vmFree(VM* vm) {
+    munmap(vm->mem, 65536);
+    if (vm->cowfd != -1) {
+        close(vm->cowfd);
+    }
+    chnFree(vm);
+    free(vm->base);
+    free(vm);
+}
 
-        case ADD: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i + r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] + reg16[srcreg2];
-            break;
-        }
+void boot(VM* vm) {
+    char* mem = vm->mem;
+    mem[PRC] = 0;
+    LEGALITY(0) = BOOT_LEGALITY;
+    mem[SMP_CPUS] = vm->ncpus;
+    *(uint16_t*)(mem + SNAP_JOB) = 0;
+    for (int i = 0; i < vm->ncpus; i++) {
+        mem[vm->cpus[i].ctl] = 0;
+    }
+}
 
-        case ADDC: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i + r%i + 1 -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] + reg16[srcreg2] + 1;
-            break;
-        }
+// runs the machine until cpu 0 halts, or the watchdog stops it
+void* start(void* arg) {
+    VM* vm = arg;
+    vm->frozen = 0;
+    watchStart(vm);
+    for (int i = 1; i < vm->ncpus; i++) {
+        pthread_create(&vm->cpus[i].thread, NULL, parked, vm->cpus + i);
+    }
+    run(vm->cpus);
+    for (int i = 1; i < vm->ncpus; i++) {
+        raiseInt(vm, i, STOP_INT);
+        pthread_join(vm->cpus[i].thread, NULL);
+    }
+    if (vm->status != EXIT_HALTED && vm->status != EXIT_FAULT) {
+        printf("STOPPED: %s, %s\n", exitReason(vm->status), vm->watch == WATCH_STOPPED ? "HARD STOP" : "HALTED BY GUEST");
+    }
+    return NULL;
+}
 
-        case SHIFTL: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i << r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] << reg16[srcreg2];
-            break;
-        }
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("not enough arguments");
+        return -1;
+    }
 
-        case SHIFTR: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg1 = mem[pc+2];
-            uint8_t srcreg2 = mem[pc+3];
-            #ifdef DEBUG
-            printf("r%i >> r%i -> r%i\n", srcreg1, srcreg2, destreg);
-            #endif
-            reg16[destreg] = reg16[srcreg1] >> reg16[srcreg2];
-            break;
+    // vm -l image.bin [options], or vm -r source.asm [options] to assemble it first, see cache.c
+    if (argv[1][0] == '-' && (argv[1][1] == 'l' || argv[1][1] == 'r')) {
+        if (argc < 3) {
+            printf("not enough arguments");
+            return -1;
         }
 
-        case LJAL: {
-            uint8_t destreg = mem[pc+1];
-            uint8_t srcreg = mem[pc+2];
-            int8_t offset = mem[pc+3];
-
-            uint8_t prc = mem[1120];
-            uint16_t newpos = reg16[srcreg] - 4;
-            reg16[destreg] = pc + offset + 4;
-            if (isReadable(newpos, prc)) {
-                #ifdef DEBUG
-                printf("LJAL from %i to %i\n", reg16[destreg], newpos + 4);
-                #endif
-                pc = newpos;
-            } else {
-                MEMEXCEPT
+        // SIGINT and SIGTERM cancel the runs in progress, see watch.c
+        watchSignals();
+        VM* vm = vmNew();
+        watchVM(vm);
+        int njobs = 1;
+        int nforks = 0;
+        char* profile = NULL;
+        char* module = NULL;
+        int status = EXIT_HALTED;
+        char* metrics = NULL;
+        int serve = 0;
+        char* saveTo = NULL;
+        Delta* delta = NULL;
+        for (int a = 3; a < argc; a += 2) {
+            if (a + 1 == argc) {
+                printf("not enough arguments");
+                return -1;
             }
-            break;
-        }
-
-        case BEQ: {
-            uint8_t srcreg1 = mem[pc+1];
-            uint8_t srcreg2 = mem[pc+2];
-            int8_t offset = mem[pc+3];
-            if (reg16[srcreg1] == reg16[srcreg2]) {
-                uint8_t prc = mem[1120];
-                uint16_t newpos = pc + offset;
-                if (isReadable(newpos, prc)) {
-                    #ifdef DEBUG
-                    printf("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos);
-                    #endif
-                    pc = newpos;
-                } else {
-                    MEMEXCEPT
+            if (argv[a][0] == '-' && argv[a][1] == 's') {
+                vm->ncpus = atoi(argv[a + 1]);
+                if (vm->ncpus < 1 || vm->ncpus > MAX_CPU) {
+                    printf("between 1 and %i cpus are supported", MAX_CPU);
+                    return -1;
+                }
+            } else if (argv[a][0] == '-' && argv[a][1] == 'j') {
+                njobs = atoi(argv[a + 1]);
+            } else if (argv[a][0] == '-' && argv[a][1] == 'f') {
+                nforks = atoi(argv[a + 1]);
+            } else if (argv[a][0] == '-' && argv[a][1] == 'p') {
+                profile = argv[a + 1];
+            } else if (argv[a][0] == '-' && argv[a][1] == 'a') {
+                module = argv[a + 1];
+            } else if (argv[a][0] == '-' && argv[a][1] == 'b') {
+                vm->budget = strtoul(argv[a + 1], NULL, 10);
+            } else if (argv[a][0] == '-' && argv[a][1] == 't') {
+                vm->timeout = strtoul(argv[a + 1], NULL, 10);
+            } else if (argv[a][0] == '-' && argv[a][1] == 'x') {
+                // with -x file, every instruction the main VM runs is traced to file
+                vm->trace = fopen(argv[a + 1], "w");
+                if (vm->trace == NULL) {
+                    printf("could not open %s", argv[a + 1]);
+                    return -1;
                 }
+            } else if (argv[a][0] == '-' && argv[a][1] == 'd') {
+                saveTo = argv[a + 1];
+            } else if (argv[a][0] == '-' && argv[a][1] == 'i') {
+                delta = loadDelta(argv[a + 1]);
+                if (delta == NULL) {
+                    printf("FATAL: COULDN'T READ DELTA %s\n", argv[a + 1]);
+                    return 1;
+                }
+            } else if (argv[a][0] == '-' && (argv[a][1] == 'm' || argv[a][1] == 'u')) {
+                metrics = argv[a + 1];
+                serve = argv[a][1] == 'u';
+            } else {
+                printf("unrecognised option %s", argv[a]);
+                return 2;
             }
-            break;
         }
 
-        case BNE: {
-            uint8_t srcreg1 = mem[pc+1];
-            uint8_t srcreg2 = mem[pc+2];
-            int8_t offset = mem[pc+3];
-            if (reg16[srcreg1] != reg16[srcreg2]) {
-                uint8_t prc = mem[1120];
-                uint16_t newpos = pc + offset;
-                if (isReadable(newpos, prc)) {
-                    #ifdef DEBUG
-                    printf("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos);
-                    #endif
-                    pc = newpos;
-                } else {
-                    MEMEXCEPT
-                }
+        long fsize;
+        if (argv[1][1] == 'r') {
+            fsize = loadSource(argv[2], vm->mem);
+            if (fsize < 0) {
+                vmFree(vm);
+                return 1;
             }
-            break;
+        } else {
+            FILE* f = fopen(argv[2], "r");
+            fseek(f, 0, SEEK_END);
+            fsize = ftell(f);
+            rewind(f);
+            fread(vm->mem, 1, fsize, f);
+            fclose(f);
         }
-        
-        case BLT: {
-            uint8_t srcreg1 = mem[pc+1];
-            uint8_t srcreg2 = mem[pc+2];
-            int8_t offset = mem[pc+3];
-            if (reg16[srcreg1] < reg16[srcreg2]) {
-                uint8_t prc = mem[1120];
-                uint16_t newpos = pc + offset;
-                if (isReadable(newpos, prc)) {
-                    #ifdef DEBUG
-                    printf("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos);
-                    #endif
-                    pc = newpos;
-                } else {
-                    MEMEXCEPT
-                }
+        verify(vm, fsize);
+        // with -a module.so, blocks translated by maot are run natively, see aot.c
+        if (module != NULL) {
+            loadTranslation(vm, module, fsize);
+        }
+        // with -p file, the opcode sequences run by the main VM are added to file, see fuse.c
+        if (profile != NULL) {
+            for (int i = 0; i < vm->ncpus; i++) {
+                vm->cpus[i].profile = calloc(1, sizeof(Profile));
             }
-            break;
         }
-        
-        case BGT: {
-            uint8_t srcreg1 = mem[pc+1];
-            uint8_t srcreg2 = mem[pc+2];
-            int8_t offset = mem[pc+3];
-            if (reg16[srcreg1] > reg16[srcreg2]) {
-                uint8_t prc = mem[1120];
-                uint16_t newpos = pc + offset;
-                if (isReadable(newpos, prc)) {
-                    #ifdef DEBUG
-                    printf("r%i == r%i; pc <- %i\n", srcreg1, srcreg2, newpos);
-                    #endif
-                    pc = newpos;
-                } else {
-                    MEMEXCEPT
-                }
+        // with -m file or -u socket, counters are exported while the VM runs, see metrics.c
+        Metrics* m = NULL;
+        if (metrics != NULL && (m = metricsStart(metrics, serve)) == NULL) {
+            vmFree(vm);
+            return 1;
+        }
+        metricsAttach(m, vm);
+
+        // with -b N and -t MS, each run may retire N instructions and take MS milliseconds, see watch.c
+        boot(vm);
+        start(vm);
+        status = vm->status;
+        // with -j N, each job after the first starts from the base, or with -i file from the base with a delta applied.
+        // once a run is cancelled, no more are started
+        for (int job = 1; job < njobs && vm->base != NULL && vm->status != EXIT_CANCELLED; job++) {
+            if (delta != NULL) {
+                applyDelta(vm, delta);
+            } else {
+                resetToBase(vm);
             }
-            break;
+            *(uint16_t*)(vm->mem + SNAP_JOB) = job;
+            start(vm);
+            if (status == EXIT_HALTED) status = vm->status;
         }
-
-        case INT: {
-            uint8_t code = mem[pc+1];
-            int8_t offset = mem[pc+2];
-
-            #ifdef DEBUG
-            printf("interrupt; c:%i, o:%i\n", code, offset);
-            #endif
-
-            INT(code, offset)
+        // with -d file, the state the last job ended in is saved as a delta against the base, see snap.c
+        if (saveTo != NULL) {
+            if (vm->base == NULL) {
+                printf("FATAL: NO BASE SNAPSHOT TO SAVE A DELTA AGAINST\n");
+            } else if (saveDelta(vm, saveTo) != 0) {
+                printf("FATAL: COULDN'T WRITE DELTA %s\n", saveTo);
+            }
         }
 
-        default: break;
+        // with -f N, N clones of the base run their jobs side by side
+        if (nforks > 0 && vm->base != NULL && vm->status != EXIT_CANCELLED) {
+            if (delta != NULL) {
+                applyDelta(vm, delta);
+            } else {
+                resetToBase(vm);
+            }
+            VM** clones = calloc(nforks, sizeof(VM*));
+            pthread_t* threads = calloc(nforks, sizeof(pthread_t));
+            for (int i = 0; i < nforks; i++) {
+                clones[i] = vmClone(vm);
+                if (clones[i] == NULL) {
+                    nforks = i;
+                    break;
+                }
+                *(uint16_t*)(clones[i]->mem + SNAP_JOB) = njobs + i;
+                watchVM(clones[i]);
+                metricsAttach(m, clones[i]);
+                pthread_create(threads + i, NULL, start, clones[i]);
+            }
+            for (int i = 0; i < nforks; i++) {
+                pthread_join(threads[i], NULL);
+                if (status == EXIT_HALTED) status = clones[i]->status;
+                metricsDetach(m, clones[i]);
+                unwatchVM(clones[i]);
+                vmFree(clones[i]);
+            }
+            free(clones);
+            free(threads);
         }
-        pc += 4;
-
-        /* IO */
-
-        #ifdef DEBUG
-        printf("stack: ptr: %i, top: %i\n", reg16[0], *(uint16_t*)(mem + reg16[0]));
-        #endif
-
-        // mem[1022] is the write flag
-        if (mem[1022] != 0) {
-            fputc(mem[1023], stdout);
-            mem[1022] = 0;
+        if (profile != NULL) {
+            if (writeProfile(vm, profile) != 0) {
+                printf("FATAL: COULDN'T WRITE PROFILE %s\n", profile);
+            }
+            for (int i = 0; i < vm->ncpus; i++) {
+                free(vm->cpus[i].profile);
+            }
         }
-
-    } while (op != HLT);
-    return;
-}
-
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("not enough arguments");
-        return -1;
-    }
-
-    if (argv[1][0] == '-' && argv[1][1] == 'l') {
-        if (argc < 3) {
-            printf("not enough arguments");
-            return -1;
+        metricsStop(m);
+        free(delta);
+        if (vm->trace != NULL) {
+            fclose(vm->trace);
         }
-
-        FILE* f = fopen(argv[2], "r");
-        fseek(f, 0, SEEK_END);
-        long fsize = ftell(f);
-        rewind(f);
-        fread(mem, 1, fsize, f);
-        fclose(f);
-        run();
-        return 1;
+        unwatchVM(vm);
+        vmFree(vm);
+        // the exit status says why the first run which didn't halt by itself ended
+        return status;
     } else {
         printf("unrecognised command %s", argv[1]);
         return 2;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SEG_SIZE 2048
+
+#define READONLY_SIZE 32
+#define READONLY SEG_SIZE - READONLY_SIZE
+
+#define PPT 1024
+#define MAX_PROC 16
+
+#define PRC PPT + 6*MAX_PROC    // one byte for the current process
+#define INT_PRC PRC + 1         // one byte for the return process
+#define INT_RET INT_PRC + 1     // two bytes for the return address
+#define INT_REQ INT_RET + 2     // one byte for the requested interrupt code
+#define INT_HAND INT_REQ + 1    // two byte pointer to the interrupt handler
+
+#define CHN INT_HAND + 2        // channel device registers, see chn.c
+#define CHN_CMD CHN             // one byte command, cleared by the VM once done
+#define CHN_STS CHN_CMD + 1     // one byte status of the last command
+#define CHN_ID CHN_STS + 1      // one byte channel number
+#define CHN_PRC CHN_ID + 1      // one byte process whose memory holds the buffer
+#define CHN_ADDR CHN_PRC + 1    // two byte buffer address, in CHN_PRC's address space
+#define CHN_LEN CHN_ADDR + 2    // two byte message length
+#define CHN_WAKE CHN_LEN + 2    // two byte mask of channels which woke a waiting receiver
+
+#define CHN_INT 1               // interrupt code raised by the channel device
+
+#define MAX_CPU 8
+
+#define SMP_CPUS CHN_WAKE + 2   // one byte number of cpus, set by the VM
+#define SMP_CTL SMP_CPUS + 1    // control blocks of cpus 1 and up
+
+#define PERF (SMP_CTL + CTL_SIZE*(MAX_CPU - 1) + 3) / 4 * 4   // read-only performance counters, see vm.c
+#define PERF_INS PERF           // four bytes: instructions retired
+#define PERF_MEMEXC PERF_INS + 4    // four bytes: memory exceptions
+#define PERF_INTS PERF_MEMEXC + 4   // four bytes: interrupts taken
+#define PERF_BRANCH PERF_INTS + 4   // four bytes: branches taken
+#define PERF_PRC PERF_BRANCH + 4    // four bytes per process: instructions retired by that process
+#define PERF_SIZE (PERF_PRC + 4*MAX_PROC - (PERF))
+
+#define SNAP PERF + PERF_SIZE   // one byte, written to by the OS to take the base snapshot, see snap.c
+#define SNAP_JOB SNAP + 1       // two byte number of the job being run
+
+// each cpu has its own copy of the registers from PRC to INT_HAND, its 'control block'.
+// cpu 0's is at PRC, and cpu n's at SMP_CTL + CTL_SIZE*(n-1)
+#define CTL_INT_PRC (INT_PRC - (PRC))
+#define CTL_INT_RET (INT_RET - (PRC))
+#define CTL_INT_REQ (INT_REQ - (PRC))
+#define CTL_INT_HAND (INT_HAND - (PRC))
+#define CTL_SIZE (INT_HAND + 2 - (PRC))
+
+#define STOP_INT 31             // pending on every cpu once the machine has halted, or been stopped by the watchdog
+#define WATCH_INT 30            // raised on cpu 0 once a run is out of budget or cancelled, see watch.c
+
+#define PAGE_SIZE 256           // granularity of dirty tracking, see snap.c
+#define NPAGES (65536 / PAGE_SIZE)
+
+typedef struct VM VM;
+
+typedef struct {
+    VM* vm;
+    uint16_t pc;
+    union {                     // 32 8-bit registers, 16 16-bit registers, 8 32-bit registers
+        uint8_t reg8[32];
+        uint16_t reg16[16];
+        uint32_t reg32[8];
+    };
+    uint8_t id;
+    uint16_t ctl;               // address of the cpu's control block
+    uint32_t irqs;              // pending interrupts, one bit per interrupt code
+    int awake;                  // whether the cpu is running rather than parked, guarded by the VM's lock
+    uint32_t retired[MAX_PROC]; // performance counters of the cpu
+    uint32_t memexcs;
+    uint32_t ints;
+    uint32_t branches;
+    uint32_t intsBy[32];        // interrupts taken, by code, see metrics.c
+    uint32_t written;           // bytes written to the console
+    struct Profile* profile;    // counts of opcode sequences run, see fuse.c
+    pthread_t thread;
+} CPU;
+
+enum INS {
+    HLT,
+
+    LIM,
+
+    LD8,
+    LD16,
+    LD32,
+
+    SV8,
+    SV16,
+    SV32,
+
+    AND,
+    OR,
+    XOR,
+    NOR,
+
+    ADD,
+    ADDC,
+    SHIFTL,
+    SHIFTR,
+
+    LJAL,
+    BEQ,
+    BNE,
+    BLT,
+    BGT,
+
+    INT,
+
+    CAS,
+    FADD,
+    IPI,
+};
+
+struct VM {
+    char* mem;                  // 64KB, mapped so that it can be shared copy-on-write, see vmClone
+    int ncpus;
+    CPU cpus[MAX_CPU];
+    pthread_mutex_t lock;       // guards parking and waking cpus
+    pthread_cond_t wake;
+
+    uint8_t vblock[65536 / 4];  // see verify.c
+    int vend;                   // end of the verified image
+    uint8_t fused[65536 / 4];   // superinstruction starting at each slot, see fuse.c
+    struct Translation* aot;    // translated blocks of the image, or NULL, see aot.c
+
+    uint8_t dirty[NPAGES];      // pages written to since the base snapshot was taken, see snap.c
+    struct Snapshot* base;
+
+    struct Channels* chn;       // see chn.c
+    pthread_mutex_t chnLock;
+
+    int cowfd;                  // frozen copy of memory shared with clones, or -1
+    int frozen;                 // whether mem is still the same as cowfd
+
+    uint32_t budget;            // instructions each run may retire, or 0 for any number, see watch.c
+    uint32_t timeout;           // milliseconds each run may take, or 0 for as long as it likes
+    int cancelled;              // set by vmCancel, and cleared once a run has been cancelled
+    int watch;                  // how far the watchdog has gone this run
+    int status;                 // why the last run ended
+    uint32_t watchIns;          // instructions retired, and the time, when the run or its grace period started
+    uint64_t watchNs;
+
+    FILE* trace;                // where instructions run are traced to, or NULL, see vm.c
+};
+
+#define OFFSET(prc) *(uint16_t*)(mem + PPT + 6*prc)
+#define LEGALITY(prc) *(uint32_t*)(mem + PPT + 2 + 6*prc)
+
+#define BOOT_LEGALITY (1u << 31)    // legality of process 0 when the VM starts
+
+// whether any of the len bytes at addr are performance counters
+#define IN_PERF(addr, len) ((uint16_t)((addr) + (len) - 1 - (PERF)) < PERF_SIZE + (len) - 1)
+
+int isReadable(VM* vm, uint16_t addr, uint8_t prc);
+int isWriteable(VM* vm, uint16_t unaddr, uint16_t addr, int len, uint8_t prc);
+uint32_t loadWrapped(char* mem, uint16_t addr, int len);
+void storeWrapped(VM* vm, uint16_t addr, int len, uint32_t value);
+void raiseInt(VM* vm, uint8_t cpu, uint8_t code);
+
+VM* vmNew();
+VM* vmClone(VM* parent);
+void vmFree(VM* vm);
@@ -0,0 +1,154 @@
+/* VM WATCHDOG */
+#include "watch.h"
+#include <time.h>
+#include <signal.h>
+#include <stdlib.h>
+
+/*
+WATCHDOG
+A run may be given a budget of instructions (vm -b N) and of wall-clock time (vm -t MS),
+and may be cancelled from any host thread with vmCancel. A cancel stays pending until a run has acted on it,
+so one made before a run starts, or between jobs, cancels the next run instead of being lost.
+Cpus look at these every WATCH_PERIOD block boundaries, so that running a block costs nothing more than a count,
+and a cancelled run stops within microseconds.
+
+Once the budget or time runs out, or the run is cancelled, WATCH_INT is raised on cpu 0, which the OS handles as any other
+interrupt, the next time a user process is running; it may then clean up and halt.
+If the guest is still running WATCH_GRACE_INS instructions or WATCH_GRACE_MS milliseconds later,
+STOP_INT is raised on every cpu, which stops the machine where it is.
+Either way, the VM's status says why the run ended, and vm exits with it.
+*/
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// instructions retired by every cpu, wrapping around
+uint32_t retiredAll(VM* vm) {
+    uint32_t total = 0;
+    for (int i = 0; i < vm->ncpus; i++) {
+        for (int p = 0; p < MAX_PROC; p++) {
+            total += __atomic_load_n(&vm->cpus[i].retired[p], __ATOMIC_RELAXED);
+        }
+    }
+    return total;
+}
+
+void watchStart(VM* vm) {
+    vm->status = EXIT_HALTED;
+    vm->watch = WATCH_RUNNING;
+    vm->watchIns = retiredAll(vm);
+    vm->watchNs = nowNs();
+}
+
+void watchdog(CPU* cpu) {
+    VM* vm = cpu->vm;
+    int stage = __atomic_load_n(&vm->watch, __ATOMIC_RELAXED);
+    if (stage == WATCH_STOPPED) return;
+    if (stage == WATCH_WARNED) {
+        if (retiredAll(vm) - vm->watchIns < WATCH_GRACE_INS && nowNs() - vm->watchNs < WATCH_GRACE_MS * 1000000ull) return;
+        if (__atomic_compare_exchange_n(&vm->watch, &stage, WATCH_STOPPED, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (int i = 0; i < vm->ncpus; i++) {
+                raiseInt(vm, i, STOP_INT);
+            }
+        }
+        return;
+    }
+
+    int reason;
+    if (__atomic_load_n(&vm->cancelled, __ATOMIC_RELAXED)) {
+        reason = EXIT_CANCELLED;
+    } else if (vm->budget != 0 && retiredAll(vm) - vm->watchIns >= vm->budget) {
+        reason = EXIT_BUDGET;
+    } else if (vm->timeout != 0 && nowNs() - vm->watchNs >= vm->timeout * 1000000ull) {
+        reason = EXIT_TIMEOUT;
+    } else {
+        return;
+    }
+    if (__atomic_compare_exchange_n(&vm->watch, &stage, WATCH_WARNED, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        if (reason == EXIT_CANCELLED) {
+            __atomic_store_n(&vm->cancelled, 0, __ATOMIC_RELAXED);
+        }
+        vm->status = reason;
+        // the grace period counts from here
+        vm->watchIns = retiredAll(vm);
+        vm->watchNs = nowNs();
+        raiseInt(vm, 0, WATCH_INT);
+    }
+}
+
+// stops the run in progress, or the next one, as if it had run out of budget. may be called from any thread
+void vmCancel(VM* vm) {
+    __atomic_store_n(&vm->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/*
+SIGNALS
+Once watchSignals has been called, SIGINT and SIGTERM no longer kill vm, but are taken by a thread of their own,
+which cancels every VM added with watchVM. Each run then stops as it would have once out of budget, and vm exits
+with EXIT_CANCELLED. watchSignals must be called before any other thread is started, so that they all leave the signals to it.
+*/
+
+static pthread_mutex_t watchedLock = PTHREAD_MUTEX_INITIALIZER;
+static VM** watched;
+static int nwatched;
+static int watchedCap;
+
+void* signalThread(void* arg) {
+    sigset_t* set = arg;
+    for (;;) {
+        int sig;
+        if (sigwait(set, &sig) != 0) continue;
+        pthread_mutex_lock(&watchedLock);
+        for (int i = 0; i < nwatched; i++) {
+            vmCancel(watched[i]);
+        }
+        pthread_mutex_unlock(&watchedLock);
+    }
+}
+
+void watchSignals() {
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, signalThread, &set);
+    pthread_detach(thread);
+}
+
+void watchVM(VM* vm) {
+    pthread_mutex_lock(&watchedLock);
+    if (nwatched == watchedCap) {
+        watchedCap = watchedCap == 0 ? 8 : watchedCap * 2;
+        watched = realloc(watched, watchedCap * sizeof(VM*));
+    }
+    watched[nwatched++] = vm;
+    pthread_mutex_unlock(&watchedLock);
+}
+
+// must be called before vm is freed
+void unwatchVM(VM* vm) {
+    pthread_mutex_lock(&watchedLock);
+    for (int i = 0; i < nwatched; i++) {
+        if (watched[i] == vm) {
+            watched[i] = watched[--nwatched];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watchedLock);
+}
+
+char* exitReason(int status) {
+    switch (status) {
+    case EXIT_HALTED: return "HALTED";
+    case EXIT_FAULT: return "FAULT";
+    case EXIT_BUDGET: return "OUT OF INSTRUCTIONS";
+    case EXIT_TIMEOUT: return "OUT OF TIME";
+    case EXIT_CANCELLED: return "CANCELLED";
+    default: return "UNKNOWN";
+    }
+}
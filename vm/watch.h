@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vm.h"
+
+#define WATCH_PERIOD 256        // block boundaries each cpu runs between looking at the watchdog
+#define WATCH_GRACE_INS 65536   // instructions the guest may still run once it has been interrupted
+#define WATCH_GRACE_MS 50       // and milliseconds
+
+// why a run ended
+enum EXIT {
+    EXIT_HALTED,        // cpu 0 halted by itself
+    EXIT_FAULT,         // an instruction couldn't be fetched, or a snapshot taken
+    EXIT_BUDGET,        // the run retired its budget of instructions
+    EXIT_TIMEOUT,       // the run took longer than its timeout
+    EXIT_CANCELLED,     // vmCancel was called
+};
+
+// how far the watchdog has gone this run
+enum WATCH {
+    WATCH_RUNNING,
+    WATCH_WARNED,       // WATCH_INT has been raised
+    WATCH_STOPPED,      // STOP_INT has been raised
+};
+
+void watchStart(VM* vm);
+void watchdog(CPU* cpu);
+void vmCancel(VM* vm);
+void watchSignals();
+void watchVM(VM* vm);
+void unwatchVM(VM* vm);
+char* exitReason(int status);
+uint64_t nowNs();